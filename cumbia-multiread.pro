@@ -51,8 +51,8 @@ PLUGIN_LIB_DIR = $${QUMBIA_PLUGINS_LIBDIR}
 
 DESTDIR = plugins
 
-VERSION_HEX = 0x010003
-VERSION = 1.0.3
+VERSION_HEX = 0x010100
+VERSION = 1.1.0
 DEFINES += CUMBIA_MULTIREAD_VERSION_STR=\"\\\"$${VERSION}\\\"\" \
     CUMBIA_MULTIREAD_VERSION=$${VERSION_HEX}
 
@@ -64,6 +64,13 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 DEFINES += QT_NO_DEBUG_OUTPUT
 
+# tracing level: 0 compiles tracing out, 1 info, 2 debug. See qumultireadertrace.h
+# Override from the command line running qmake "TRACE_LEVEL=2"
+isEmpty(TRACE_LEVEL) {
+    TRACE_LEVEL = 0
+}
+DEFINES += QUMULTIREADER_TRACE_LEVEL=$${TRACE_LEVEL}
+
 unix:!android-g++ {
     DEFINES += CUMBIAQTCONTROLS_HAS_QWT=1
 }
@@ -86,7 +93,8 @@ inc.path = $${INC_DIR}
 # defined in cumbia-qtcontrols.pri, by default $${INSTALL_ROOT}/include/cumbia-qtcontrols
 #
 iface_inc.path = $${CUMBIA_QTCONTROLS_INCLUDES}
-iface_inc.files = qumultireaderplugininterface.h
+iface_inc.files = qumultireaderplugininterface.h \
+    qumultireadersnapshot.h
 
 # installation
 
@@ -105,10 +113,19 @@ TEMPLATE = lib
 CONFIG += plugin debug
 
 SOURCES += \
-    qumultireader.cpp
+    qumultireader.cpp \
+    qumultireadertrace.cpp \
+    qumultireaderhistogram.cpp \
+    qumultireaderphasescheduler.cpp \
+    qumultireaderregistry.cpp
 
 HEADERS += \
-    qumultireader.h
+    qumultireader.h \
+    qumultireadersnapshot.h \
+    qumultireadertrace.h \
+    qumultireaderhistogram.h \
+    qumultireaderphasescheduler.h \
+    qumultireaderregistry.h
 
 DISTFILES += cumbia-multiread.json  \
     qumultireaderplugininterface.h
@@ -1,20 +1,354 @@
 #include "qumultireader.h"
+#include "qumultireadertrace.h"
+#include "qumultireaderhistogram.h"
+#include "qumultireaderphasescheduler.h"
+#include "qumultireaderregistry.h"
 #include <cucontext.h>
 #include <cucontrolsreader_abs.h>
 #include <cudata.h>
 #include <QTimer>
 #include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QVector>
+#include <QBitArray>
+#include <QMetaMethod>
+#include <QDateTime>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QSharedPointer>
 #include <QtDebug>
 
+// a read cycle in flight, when more than one is allowed (see QuMultiReader::setPipelineDepth)
+class QuMultiReaderCycle
+{
+public:
+    QuMultiReaderCycle(int n = 0, quint64 seq = 0, qint64 start_ns = -1) :
+        values(n), stamps(n, 0), received(n), received_cnt(0), seq(seq), start_ns(start_ns) {}
+
+    QVector<CuData> values;
+    QVector<qint64> stamps;
+    QBitArray received;
+    QBitArray changed; // flags delivered with the snapshot, if not empty. Otherwise received
+    int received_cnt;
+    quint64 seq;
+    qint64 start_ns;
+};
+
+// values grouped by acquisition time (see QuMultiReader::setTimeAlignment). stamps hold the
+// acquisition timestamps, start_ns the time the bucket has been opened
+class QuMultiReaderBucket : public QuMultiReaderCycle
+{
+public:
+    QuMultiReaderBucket(int n = 0, quint64 seq = 0, qint64 start_ns = -1, qint64 t0_ms = 0) :
+        QuMultiReaderCycle(n, seq, start_ns), t0_ms(t0_ms) {}
+
+    qint64 t0_ms; // acquisition timestamp of the first value, ms since the epoch
+};
+
 class QuMultiReaderPrivate
 {
 public:
     QMap<QString, CuControlsReaderA* > readersMap;
     int period, mode;
     CuContext *context;
+    // owns context, that is shared with the child multi readers if ctx_shared (see setChildContextSharing)
+    QSharedPointer<CuContext> ctx_ref;
+    bool ctx_shared, share_ctx_with_children;
     QTimer *timer;
-    QMap<int, CuData> databuf;
     QMap<int, QString> idx_src_map;
+    // reverse indexes of idx_src_map: full source and source without args to slot index
+    // (the indexes of all the sources sharing the same name, ascending: the smallest wins)
+    QHash<QString, int> src_idx_map;
+    QHash<QString, QMap<int, bool> > src_noargs_idx_map;
+
+    // cycle buffer: one slot per source, in ascending index order.
+    // received tracks the slots updated in the current cycle, received_cnt counts them.
+    // valid tracks the slots that have been updated at least once, changed the slots updated
+    // since the last snapshot
+    QVector<CuData> databuf;
+    QBitArray received, valid, changed;
+    QBitArray flush_changed; // slots updated since the last coalesced notification (see setCoalescingWindow)
+    int received_cnt;
+    QVector<qint64> stamps; // time of arrival of each slot, ms since epoch
+    quint64 cycle_cnt;
+    QVector<int> pos_idx; // buffer position to slot index
+    QVector<QString> pos_src; // buffer position to source
+    QHash<int, int> idx_pos_map; // slot index to buffer position
+    bool layout_dirty;
+    // instrumentation, see QuMultiReader::stats. Times in ns from clock, -1 if unset.
+    // arrival: per slot offset from the start of the cycle; upd_cnt, err_cnt: per slot counters
+    QElapsedTimer clock;
+    qint64 cycle_start_ns, last_cycle_start_ns, last_cycle_end_ns;
+    qint64 last_cycle_start_ms; // ms since epoch
+    QVector<qint64> arrival;
+    QVector<quint64> upd_cnt, err_cnt;
+    quint64 updates, errors;
+    // distributions: cycle duration, onUpdate processing time, per slot interval between updates
+    QuMultiReaderHistogram cycle_hist, proc_hist;
+    QVector<QuMultiReaderHistogram> interval_hist;
+    QVector<qint64> last_upd_ns; // per slot time of the last update, -1 if never updated
+
+    // sequential modes: maximum number of cycles in flight, and the cycles in flight, oldest first.
+    // Unused if pipeline_depth is 1
+    int pipeline_depth;
+    QList<QuMultiReaderCycle> inflight;
+    quint64 pipeline_overwrites;
+    // per buffer position: the cycle waiting for the slot has been closed at the deadline. The next value
+    // of the slot belongs to it and is dropped, unless startRead begins a new cycle first
+    QBitArray late;
+    quint64 late_drops;
+
+    // cycle deadline, ms (disabled if <= 0), what to deliver for the missing values, the
+    // timer and the start of the cycle it is armed for
+    int deadline_ms, deadline_policy;
+    QTimer *deadline_timer;
+    qint64 deadline_armed_ns;
+    quint64 deadline_misses;
+
+    // adaptive period: target fraction of the period spent reading (disabled if <= 0), bounds
+    // and moving average of the cycle duration, ms (-1 before the first cycle)
+    double adapt_load;
+    int adapt_min_ms, adapt_max_ms;
+    double cycle_ewma_ms;
+
+    // fixed rate schedule (SequentialManual): period (disabled if <= 0) and phase, ms, overrun policy,
+    // the next tick, ms since the epoch, and whether a cycle must start as soon as the current completes
+    int sched_period_ms, sched_phase_ms, sched_policy;
+    QTimer *sched_timer;
+    qint64 sched_next_ms;
+    bool sched_pending;
+    quint64 overruns;
+    bool stagger; // phase assigned by QuMultiReaderPhaseScheduler
+
+    // sequential modes: sources are partitioned across shards thread tokens, by a hash of the source
+    // (without args), that does not change when setSources moves a reader to another index
+    int shards;
+    // sequential modes: how thread tokens are chosen (QuMultiReaderPluginInterface::ThreadPolicy),
+    // pool name for ThreadPool
+    int thread_policy;
+    QString thread_pool;
+    // the first source of each thread token, that startRead sends the read command to.
+    // Rebuilt when the sources or the thread policy change
+    QStringList starters;
+    QStringList tokens;
+    bool starters_dirty;
+    // refresh tiers (SequentialManual): per source period, ms, so that it follows the source when setSources
+    // moves it. Sources not in the map are read at every cycle.
+    // Per thread token (same order as starters): tier period, last time it was read (ns from clock, -1 never).
+    // Per buffer position: the thread token, index in tokens
+    QHash<QString, int> src_period;
+    QVector<int> starter_period;
+    QVector<qint64> starter_last_ns;
+    QVector<int> pos_token;
+    // partial read (SequentialManual, see startRead(QList<int>)): per buffer position, the slots requested
+    // and those still awaited, their number (0: no partial read in progress), start time (ns from clock)
+    // and the timer completing it at the cycle deadline
+    QBitArray partial_want, partial_wait;
+    int partial_left;
+    qint64 partial_start_ns;
+    QTimer *partial_timer;
+
+    // freshness barrier (concurrent mode, see onAllFresh): slots updated since the last barrier, their number,
+    // barriers passed
+    QBitArray fresh;
+    int fresh_cnt;
+    quint64 barrier_cnt;
+
+    // time alignment (concurrent mode, see setTimeAlignment): window and timeout, ms (disabled if window <= 0),
+    // open buckets, oldest first, the timer armed on the timeout of the oldest, buckets emitted and how many incomplete,
+    // the timestamp of the last bucket emitted (ms since the epoch, -1 none) and the values older than it, discarded
+    int align_ms, align_timeout_ms;
+    QList<QuMultiReaderBucket> buckets;
+    QTimer *align_timer;
+    quint64 bucket_cnt, bucket_incomplete;
+    qint64 bucket_last_t0_ms;
+    quint64 bucket_late;
+
+    // backpressure (sequential modes, see setBackpressure): policy, maximum number of cycles delivered and
+    // not acknowledged, cycles delivered and not acknowledged, the latest cycle held back (BackpressureDropOldest)
+    // and the number of cycles dropped or not started
+    int bp_policy, bp_max, unacked;
+    QuMultiReaderSnapshot bp_held;
+    quint64 dropped_cycles;
+
+    // concurrent mode: readers shared with the other multi readers through QuMultiReaderRegistry,
+    // and the sources whose last value is to be replayed once the insertion is over
+    bool shared;
+    QStringList replay_pending;
+
+    // coalescing window, ms. Disabled if <= 0
+    int coalesce_ms;
+    QTimer *flush_timer;
+
+    // lay out the buffer again after sources have been added, removed or moved.
+    // Data and statistics of the surviving sources are preserved, whatever their new index
+    void relayout() {
+        const int n = idx_src_map.size();
+        QVector<CuData> buf(n);
+        QBitArray rec(n), val(n), ch(n), fch(n), fr(n);
+        QVector<qint64> st(n, 0);
+        QVector<int> pi(n);
+        QVector<QString> ps(n);
+        QVector<qint64> arr(n, -1);
+        QVector<quint64> uc(n, 0), ec(n, 0);
+        QVector<QuMultiReaderHistogram> ih(n);
+        QVector<qint64> lu(n, -1);
+        QHash<int, int> ipm;
+        ipm.reserve(n);
+        QHash<QString, int> oldpos;
+        oldpos.reserve(pos_src.size());
+        for(int q = 0; q < pos_src.size(); q++)
+            oldpos.insert(pos_src[q], q);
+        received_cnt = fresh_cnt = 0;
+        int p = 0;
+        for(QMap<int, QString>::const_iterator it = idx_src_map.constBegin(); it != idx_src_map.constEnd(); ++it, ++p) {
+            const int oldp = oldpos.value(it.value(), -1);
+            if(oldp >= 0 && valid.testBit(oldp)) {
+                buf[p] = databuf[oldp];
+                st[p] = stamps[oldp];
+                val.setBit(p);
+                ch.setBit(p, changed.testBit(oldp));
+                fch.setBit(p, flush_changed.testBit(oldp));
+                if(received.testBit(oldp)) {
+                    rec.setBit(p);
+                    received_cnt++;
+                }
+                if(fresh.testBit(oldp)) {
+                    fr.setBit(p);
+                    fresh_cnt++;
+                }
+            }
+            if(oldp >= 0) {
+                arr[p] = arrival[oldp];
+                uc[p] = upd_cnt[oldp];
+                ec[p] = err_cnt[oldp];
+                ih[p] = interval_hist[oldp];
+                lu[p] = last_upd_ns[oldp];
+            }
+            pi[p] = it.key();
+            ps[p] = it.value();
+            ipm.insert(it.key(), p);
+        }
+        idx_pos_map.swap(ipm);
+        databuf.swap(buf);
+        received = rec;
+        valid = val;
+        changed = ch;
+        flush_changed = fch;
+        fresh = fr;
+        stamps.swap(st);
+        pos_idx.swap(pi);
+        pos_src.swap(ps);
+        arrival.swap(arr);
+        upd_cnt.swap(uc);
+        err_cnt.swap(ec);
+        interval_hist.swap(ih);
+        last_upd_ns.swap(lu);
+        inflight.clear(); // cycles in flight refer to the former layout
+        late = QBitArray(n);
+        partial_want = partial_wait = QBitArray(); // and so does a partial read
+        buckets.clear(); // and time aligned buckets
+        partial_left = 0;
+        layout_dirty = false;
+    }
+
+    void cycle_reset() {
+        received.fill(false);
+        received_cnt = 0;
+    }
+
+    // values of the slots set in bits (received or valid), in ascending index order
+    QList<CuData> values(const QBitArray& bits) const {
+        QList<CuData> l;
+        l.reserve(bits.count(true));
+        for(int p = 0; p < databuf.size(); p++)
+            if(bits.testBit(p))
+                l.append(databuf[p]);
+        return l;
+    }
+
+    // shared snapshot of the slots set in bits (received or valid)
+    QuMultiReaderSnapshot snapshot(const QBitArray& bits) const {
+        return snapshot(bits, changed, cycle_cnt);
+    }
+
+    // shared snapshot of the slots set in bits, with the changed flags taken from chbits and sequence number seq
+    QuMultiReaderSnapshot snapshot(const QBitArray& bits, const QBitArray& chbits, quint64 seq) const {
+        QList<int> idxs;
+        QVector<qint64> ts;
+        const int n = bits.count(true);
+        QBitArray ch(n);
+        idxs.reserve(n);
+        ts.reserve(n);
+        for(int p = 0; p < databuf.size(); p++)
+            if(bits.testBit(p)) {
+                ch.setBit(idxs.size(), chbits.testBit(p));
+                idxs.append(pos_idx[p]);
+                ts.append(stamps[p]);
+            }
+        return QuMultiReaderSnapshot(idxs, values(bits), ts, ch, seq);
+    }
+
+    // snapshot of a cycle in flight. Slots not received are filled according to deadline_policy
+    QuMultiReaderSnapshot snapshot(const QuMultiReaderCycle& c) const {
+        QList<CuData> l;
+        QVector<qint64> ts = c.stamps;
+        l.reserve(c.values.size());
+        for(int p = 0; p < c.values.size(); p++) {
+            if(c.received.testBit(p))
+                l.append(c.values[p]);
+            else {
+                l.append(stale(p));
+                ts[p] = valid.testBit(p) ? stamps[p] : 0;
+            }
+        }
+        return QuMultiReaderSnapshot(pos_idx.toList(), l, ts, c.changed.isEmpty() ? c.received : c.changed, c.seq);
+    }
+
+    // the value delivered for the slot at position p when missing at the cycle deadline
+    CuData stale(int p) const {
+        CuData da;
+        if(deadline_policy == QuMultiReaderPluginInterface::DeadlineLastValue && valid.testBit(p))
+            da = databuf[p];
+        else {
+            da["src"] = pos_src[p].toStdString();
+            da["err"] = true;
+            da["msg"] = std::string("QuMultiReader: no value within the cycle deadline");
+        }
+        da["stale"] = true;
+        return da;
+    }
+
+    void index_insert(int i, const QString& src) {
+        index_remove(src); // at most one index per source
+        layout_dirty = starters_dirty = true;
+        src_idx_map.insert(src, i);
+        src_noargs_idx_map[src.section('(', 0, 0)].insert(i, true);
+    }
+    void index_remove(const QString& src) {
+        if(!src_idx_map.contains(src))
+            return;
+        layout_dirty = starters_dirty = true;
+        const int i = src_idx_map.take(src);
+        QHash<QString, QMap<int, bool> >::iterator it = src_noargs_idx_map.find(src.section('(', 0, 0));
+        if(it != src_noargs_idx_map.end()) {
+            it.value().remove(i);
+            if(it.value().isEmpty())
+                src_noargs_idx_map.erase(it);
+        }
+    }
+    // like the former linear search, the smallest index wins among sources sharing the same name
+    int noargs_index(const QString& noargs) const {
+        QHash<QString, QMap<int, bool> >::const_iterator it = src_noargs_idx_map.constFind(noargs);
+        return it != src_noargs_idx_map.constEnd() ? it.value().firstKey() : -1;
+    }
+    void index_clear() {
+        layout_dirty = starters_dirty = true;
+        src_idx_map.clear();
+        src_noargs_idx_map.clear();
+    }
 };
 
 QuMultiReader::QuMultiReader(QObject *parent) :
@@ -25,23 +359,77 @@ QuMultiReader::QuMultiReader(QObject *parent) :
     d->mode = SequentialReads; // sequential reading
     d->timer = NULL;
     d->context = NULL;
+    d->ctx_shared = d->share_ctx_with_children = false;
+    d->received_cnt = 0;
+    d->cycle_cnt = 0;
+    d->layout_dirty = false;
+    d->coalesce_ms = 0;
+    d->flush_timer = NULL;
+    d->clock.start();
+    d->cycle_start_ns = d->last_cycle_start_ns = d->last_cycle_end_ns = -1;
+    d->last_cycle_start_ms = -1;
+    d->updates = d->errors = 0;
+    d->pipeline_depth = 1;
+    d->pipeline_overwrites = 0;
+    d->late_drops = 0;
+    d->deadline_ms = -1;
+    d->deadline_policy = DeadlineMarkStale;
+    d->deadline_timer = NULL;
+    d->deadline_armed_ns = -1;
+    d->deadline_misses = 0;
+    d->adapt_load = -1;
+    d->adapt_min_ms = d->adapt_max_ms = -1;
+    d->cycle_ewma_ms = -1;
+    d->sched_period_ms = d->sched_phase_ms = 0;
+    d->sched_policy = OverrunSkip;
+    d->sched_timer = NULL;
+    d->sched_next_ms = -1;
+    d->sched_pending = false;
+    d->overruns = 0;
+    d->stagger = false;
+    d->shards = 1;
+    d->thread_policy = ThreadShared;
+    d->starters_dirty = false;
+    d->partial_left = 0;
+    d->partial_start_ns = -1;
+    d->partial_timer = NULL;
+    d->fresh_cnt = 0;
+    d->barrier_cnt = 0;
+    d->align_ms = d->align_timeout_ms = 0;
+    d->align_timer = NULL;
+    d->bucket_cnt = d->bucket_incomplete = 0;
+    d->bucket_last_t0_ms = -1;
+    d->bucket_late = 0;
+    d->shared = false;
+    d->bp_policy = BackpressureNone;
+    d->bp_max = 1;
+    d->unacked = 0;
+    d->dropped_cycles = 0;
+    qRegisterMetaType<QuMultiReaderSnapshot>("QuMultiReaderSnapshot");
 }
 
 QuMultiReader::~QuMultiReader()
 {
-    if(d->context)
-        delete d->context;
-    delete d;
+    if(d->stagger && d->sched_period_ms > 0)
+        QuMultiReaderPhaseScheduler::instance()->leave(this);
+    if(d->shared)
+        QuMultiReaderRegistry::instance()->unsubscribeAll(this); // readers owned by the registry
+    else if(d->ctx_shared) // the context may outlive this: readers must not notify a deleted listener
+        foreach(const QString& src, d->readersMap.keys())
+            d->context->disposeReader(src.toStdString());
+    delete d; // the context is deleted with its last user
 }
 
 void QuMultiReader::init(Cumbia *cumbia, const CuControlsReaderFactoryI &r_fac, int mode) {
-    d->context = new CuContext(cumbia, r_fac);
+    d->ctx_ref = QSharedPointer<CuContext>(new CuContext(cumbia, r_fac));
+    d->context = d->ctx_ref.data();
     d->mode = mode;
     if(d->mode >= SequentialManual) d->period = -1;
 }
 
 void QuMultiReader::init(CumbiaPool *cumbia_pool, const CuControlsFactoryPool &fpool, int mode) {
-    d->context = new CuContext(cumbia_pool, fpool);
+    d->ctx_ref = QSharedPointer<CuContext>(new CuContext(cumbia_pool, fpool));
+    d->context = d->ctx_ref.data();
     d->mode = mode;
     if(d->mode >= SequentialManual) d->period = -1;
 }
@@ -52,64 +440,333 @@ void QuMultiReader::sendData(const QString &s, const CuData &da) {
 }
 
 void QuMultiReader::sendData(int index, const CuData &da) {
-    const QString& src = d->idx_src_map[index];
+    const QString& src = d->idx_src_map.value(index);
     if(!src.isEmpty())
         sendData(src, da);
 }
 
+/** \brief replaces the current sources with srcs, source at position i taking index i
+ *
+ * Readers of the sources found in both lists are kept and moved to their new index,
+ * only the sources no more in srcs are disposed and only the new ones are added.
+ * Buffered data and statistics of the surviving sources are preserved.
+ */
 void QuMultiReader::setSources(const QStringList &srcs)
 {
-    unsetSources();
-    for(int i = 0; i < srcs.size(); i++)
-        insertSource(srcs[i], i);
+    QSet<QString> keep;
+    foreach(const QString& s, srcs)
+        if(d->src_idx_map.contains(s))
+            keep.insert(s);
+    foreach(const QString& s, d->idx_src_map.values())
+        if(!keep.contains(s))
+            removeSource(s);
+    // re-index the survivors, then add the new sources
+    d->idx_src_map.clear();
+    d->index_clear();
+    QList<int> added;
+    for(int i = 0; i < srcs.size(); i++) {
+        if(keep.contains(srcs[i]) && !d->src_idx_map.contains(srcs[i])) {
+            d->idx_src_map.insert(i, srcs[i]);
+            d->index_insert(i, srcs[i]);
+        }
+        else
+            added << i;
+    }
+    qumr_trace(QUMR_TRACE_INFO, "QuMultiReader.setSources: %d kept, %d added", d->idx_src_map.size(), added.size());
+    QList<QPair<QString, int> > l;
+    l.reserve(added.size());
+    foreach(int i, added)
+        l << qMakePair(srcs[i], i);
+    m_insertSources(l);
 }
 
 void QuMultiReader::unsetSources()
 {
-    d->context->disposeReader(); // empty arg: dispose all
+    if(d->shared)
+        QuMultiReaderRegistry::instance()->unsubscribeAll(this);
+    else if(d->ctx_shared) // other multi readers' readers live in the same context
+        foreach(const QString& src, d->readersMap.keys())
+            d->context->disposeReader(src.toStdString());
+    else
+        d->context->disposeReader(); // empty arg: dispose all
     d->idx_src_map.clear();
+    d->index_clear();
     d->readersMap.clear();
+    d->src_period.clear();
 }
 
-/** \brief inserts src at index position i in the list. i must be >= 0
+/** \brief inserts src at index position i in the list. If i < 0, src is prepended to the list
+ *
+ * Indexes are not shifted: if a source is already at index i, it is replaced and its reader disposed,
+ * as if removeSource had been called.
  *
  * @see setSources
+ * @see insertSources
  */
 void QuMultiReader::insertSource(const QString &src, int i) {
-    if(i < 0)
-        perr("QuMultiReader.insertSource: i must be >= 0");
+    if(i < 0) // before the smallest index
+        i = d->idx_src_map.isEmpty() ? -1 : qMin(-1, d->idx_src_map.firstKey() - 1);
+    m_insertSources(QList<QPair<QString, int> >() << qMakePair(src, i));
+}
+
+/** \brief inserts the sources in srcs, the first at index firstIndex, the following at consecutive indexes
+ *
+ * Equivalent to calling insertSource for each source, so sources already at the indexes in the range
+ * are replaced and their readers disposed, but the reader options are configured once
+ * for the whole list. Use it to set up a large number of sources.
+ *
+ * @see insertSource
+ */
+void QuMultiReader::insertSources(const QStringList &srcs, int firstIndex) {
+    if(firstIndex < 0)
+        perr("QuMultiReader.insertSources: firstIndex must be >= 0");
     else {
-        cuprintf("\e[1;35mQuMultiReader.insertSource %s --> %d\e[0m\n", qstoc(src), i);
-        CuData options;
-        if(d->mode >= SequentialManual) {
-            options["manual"] = true;
-        }
-        else if(d->mode == SequentialReads && d->period > 0)  {
-            // readings in the same thread
-            options["refresh_mode"] = 1; // CuTReader::PolledRefresh
-            options["period"] = d->period;
-        }
-        if(d->mode >= SequentialReads) // manual or seq
-            options["thread_token"] = QString("multi_reader_%1").arg(objectName()).toStdString();
-        d->context->setOptions(options);
-        printf("QuMultiReader.insertSource: options passed: %s\n", datos(options));
+        QList<QPair<QString, int> > l;
+        l.reserve(srcs.size());
+        for(int i = 0; i < srcs.size(); i++)
+            l << qMakePair(srcs[i], firstIndex + i);
+        m_insertSources(l);
+    }
+}
+
+// add a reader for each (source, index) pair. Options are the same for all the readers
+// sharing a thread token, so they are set on the context once per thread token
+void QuMultiReader::m_insertSources(const QList<QPair<QString, int> > &srcs) {
+    if(srcs.isEmpty())
+        return;
+    CuData options;
+    if(d->mode >= SequentialManual) {
+        options["manual"] = true;
+    }
+    else if(d->mode == SequentialReads && d->period > 0)  {
+        // readings in the same thread
+        options["refresh_mode"] = 1; // CuTReader::PolledRefresh
+        options["period"] = d->period;
+    }
+    d->src_idx_map.reserve(d->src_idx_map.size() + srcs.size());
+    const bool was_empty = d->idx_src_map.isEmpty();
+    if(d->mode >= SequentialReads) { // manual or seq
+        QMap<QString, QList<QPair<QString, int> > > groups;
+        for(QList<QPair<QString, int> >::const_iterator it = srcs.constBegin(); it != srcs.constEnd(); ++it)
+            groups[m_threadToken(it->first)].append(*it);
+        for(QMap<QString, QList<QPair<QString, int> > >::const_iterator it = groups.constBegin(); it != groups.constEnd(); ++it) {
+            options["thread_token"] = it.key().toStdString();
+            d->context->setOptions(options);
+            qumr_trace(QUMR_TRACE_INFO, "QuMultiReader.m_insertSources: %d sources, options passed: %s", it.value().size(), datos(options));
+            m_addReaders(it.value());
+        }
     }
-    CuControlsReaderA* r = d->context->add_reader(src.toStdString(), this);
-    if(r) {
-        r->setSource(src); // then use r->source, not src
-        d->readersMap.insert(r->source(), r);
-        d->idx_src_map.insert(i, r->source());
+    else {
+        d->context->setOptions(options);
+        qumr_trace(QUMR_TRACE_INFO, "QuMultiReader.m_insertSources: %d sources, options passed: %s", srcs.size(), datos(options));
+        m_addReaders(srcs);
     }
-    if(d->idx_src_map.size() == 1 && d->mode == SequentialReads)
+    if(was_empty && !d->idx_src_map.isEmpty() && d->mode == SequentialReads)
         m_timerSetup();
+}
+
+// thread token of the reader of src in sequential modes
+QString QuMultiReader::m_threadToken(const QString& src) const {
+    QString t;
+    switch(d->thread_policy) {
+    case ThreadPerDevice: // the source without the last section (attribute, command...) and args
+        t = QString("multi_reader_dev_%1").arg(src.section('(', 0, 0).section('/', 0, -2));
+        break;
+    case ThreadDedicated:
+        t = QString("multi_reader_%1_%2").arg(objectName()).arg(reinterpret_cast<quintptr>(this), 0, 16);
+        break;
+    case ThreadPool:
+        t = QString("multi_reader_pool_%1").arg(d->thread_pool);
+        break;
+    default:
+        t = QString("multi_reader_%1").arg(objectName());
+        break;
+    }
+    if(d->shards > 1 && d->thread_policy != ThreadPerDevice)
+        t += QString("_%1").arg(qHash(src.section('(', 0, 0)) % d->shards);
+    if(d->src_period.contains(src)) // each refresh tier is triggered separately, whatever the policy
+        t += QString("_t%1").arg(d->src_period.value(src));
+    return t;
+}
+
+// deliver the last values of the shared sources just added, with the whole batch inserted
+// and the buffer laid out once
+void QuMultiReader::m_replayShared() {
+    const QStringList srcs = d->replay_pending;
+    d->replay_pending.clear();
+    foreach(const QString& src, srcs)
+        if(d->readersMap.contains(src)) // not removed in the meantime
+            QuMultiReaderRegistry::instance()->replay(this, src, d->context);
+}
+
+// readers must be created again when their thread token changes
+void QuMultiReader::m_recreateReaders() {
+    if(d->mode >= SequentialReads && !d->idx_src_map.isEmpty() && d->context) {
+        QList<QPair<QString, int> > l;
+        for(QMap<int, QString>::const_iterator it = d->idx_src_map.constBegin(); it != d->idx_src_map.constEnd(); ++it)
+            l << qMakePair(it.value(), it.key());
+        const QHash<QString, int> periods = d->src_period; // unsetSources clears them
+        unsetSources();
+        d->src_period = periods;
+        m_insertSources(l);
+    }
+}
+
+// the first source of each thread token, in index order
+// and the tier period of each token. pos_token follows the buffer layout, that is
+// the same ascending index order
+void QuMultiReader::m_updateStarters() {
+    d->starters.clear();
+    d->tokens.clear();
+    d->starter_period.clear();
+    d->pos_token.resize(d->idx_src_map.size());
+    QHash<QString, int> seen;
+    int p = 0;
+    for(QMap<int, QString>::const_iterator it = d->idx_src_map.constBegin(); it != d->idx_src_map.constEnd(); ++it, ++p) {
+        const QString& t = m_threadToken(it.value());
+        if(!seen.contains(t)) {
+            seen.insert(t, d->tokens.size());
+            d->tokens << t;
+            d->starters << it.value();
+            d->starter_period << d->src_period.value(it.value(), 0);
+        }
+        d->pos_token[p] = seen.value(t);
+    }
+    d->starter_last_ns = QVector<qint64>(d->tokens.size(), -1);
+    d->starters_dirty = false;
+}
+
+/*!
+ * \brief Choose the thread the readers run in, in sequential modes
+ * \param policy one of QuMultiReaderPluginInterface::ThreadPolicy
+ * \param pool_name the name of the pool, if policy is ThreadPool: multi readers with the same pool name
+ *        share the same thread
+ *
+ * \li ThreadShared (the default): the thread token is derived from objectName. Multi readers without
+ *     a name share the same thread
+ * \li ThreadDedicated: this multi reader has its own thread
+ * \li ThreadPool: multi readers with the same pool_name share the same thread
+ * \li ThreadPerDevice: sources of the same device (the source without its last section) share a thread,
+ *     across all the multi readers using this policy. Devices are read in parallel
+ *
+ * With ThreadShared, ThreadDedicated and ThreadPool, sources are further partitioned if setShards has been
+ * called with n > 1.
+ * Readers already configured are disposed and created again with the new thread token.
+ *
+ * @see threadTokens
+ */
+void QuMultiReader::setThreadPolicy(int policy, const QString &pool_name) {
+    if(policy == ThreadPool && pool_name.isEmpty()) {
+        perr("QuMultiReader.setThreadPolicy: ThreadPool requires a pool name");
+        return;
+    }
+    if(policy == d->thread_policy && pool_name == d->thread_pool)
+        return;
+    d->thread_policy = policy;
+    d->thread_pool = pool_name;
+    d->starters_dirty = true;
+    m_recreateReaders();
+}
+
+/*!
+ * \brief Returns the thread policy
+ *
+ * @see setThreadPolicy
+ */
+int QuMultiReader::threadPolicy() const {
+    return d->thread_policy;
+}
+
+/*!
+ * \brief Returns the thread tokens in use in sequential modes. An empty list in concurrent mode
+ *
+ * cumbia runs the readers sharing a thread token in the same thread, so each token identifies a thread.
+ * Tokens are in the order of the first source read in each thread.
+ */
+QStringList QuMultiReader::threadTokens() const {
+    if(d->mode < SequentialReads)
+        return QStringList();
+    if(d->starters_dirty)
+        const_cast<QuMultiReader *>(this)->m_updateStarters();
+    return d->tokens;
+}
+
+// create the readers with the options currently set on the context
+void QuMultiReader::m_addReaders(const QList<QPair<QString, int> > &srcs) {
+    const bool replay_queued = !d->replay_pending.isEmpty();
+    for(QList<QPair<QString, int> >::const_iterator it = srcs.constBegin(); it != srcs.constEnd(); ++it) {
+        const QString& src = it->first;
+        const int i = it->second;
+        qumr_trace(QUMR_TRACE_DEBUG, "QuMultiReader.m_insertSources %s --> %d", qstoc(src), i);
+        // readers are disposed by source: in a shared context, a source read by another multi reader cannot be added
+        if(d->ctx_shared && !d->shared && !d->readersMap.contains(src) && d->context->findReader(src.toStdString())) {
+            perr("QuMultiReader.m_insertSources: \"%s\" is already read by another multi reader sharing the context: not added",
+                 qstoc(src));
+            continue;
+        }
+        if(d->idx_src_map.contains(i)) // slot i is being replaced: dispose the reader of the former source
+            removeSource(d->idx_src_map.value(i));
+        CuControlsReaderA* r = d->shared ? QuMultiReaderRegistry::instance()->subscribe(this, src, d->context)
+                                         : d->context->add_reader(src.toStdString(), this);
+        if(r) {
+            if(!d->shared) // shared readers are set up by the registry
+                r->setSource(src); // then use r->source, not src
+            d->readersMap.insert(r->source(), r);
+            d->idx_src_map.insert(i, r->source());
+            d->index_insert(i, r->source());
+            if(d->shared)
+                d->replay_pending << r->source();
+        }
+    }
+    if(!replay_queued && !d->replay_pending.isEmpty()) // once for all the batches before the event loop runs
+        QMetaObject::invokeMethod(this, "m_replayShared", Qt::QueuedConnection);
+}
 
+/*!
+ * \brief Partition the sources across n threads in sequential modes
+ * \param n the number of shards. If n <= 0, QThread::idealThreadCount is used. 1 (the default) reads
+ *        all the sources in the same thread
+ *
+ * Each source is read in the thread of the shard chosen by a hash of its name, so that its shard does not change
+ * when setSources moves it to another index. Each shard reads its own sources sequentially,
+ * and shards run in parallel. onSeqReadComplete and onSnapshot are still emitted once per cycle, with all the
+ * values in ascending order of their indexes, when the last shard delivers its values.
+ * In SequentialManual mode, startRead triggers a read in every shard.
+ *
+ * Readers already configured are disposed and created again in their shard.
+ */
+void QuMultiReader::setShards(int n) {
+    if(n <= 0)
+        n = qMax(1, QThread::idealThreadCount());
+    if(n == d->shards)
+        return;
+    d->shards = n;
+    d->starters_dirty = true;
+    m_recreateReaders();
+}
+
+/*!
+ * \brief Returns the number of threads the sources are partitioned across in sequential modes
+ *
+ * @see setShards
+ */
+int QuMultiReader::shards() const {
+    return d->shards;
 }
 
 void QuMultiReader::removeSource(const QString &src) {
-    if(d->context)
+    if(d->shared)
+        QuMultiReaderRegistry::instance()->unsubscribe(this, src, d->context);
+    else if(d->context)
         d->context->disposeReader(src.toStdString());
-    d->idx_src_map.remove(d->idx_src_map.key(src));
+    QHash<QString, int>::const_iterator it = d->src_idx_map.constFind(src);
+    if(it != d->src_idx_map.constEnd()) {
+        d->idx_src_map.remove(it.value());
+        d->index_remove(src);
+    }
     d->readersMap.remove(src);
+    if(d->src_period.remove(src) > 0)
+        d->starters_dirty = true;
 }
 
 /** \brief returns a reference to this object, so that it can be used as a QObject
@@ -147,7 +804,7 @@ void QuMultiReader::setPeriod(int ms) {
     if(d->mode == SequentialReads && ms > 0) {
         CuData per("period", ms);
         per["refresh_mode"] = 1;
-        foreach(CuControlsReaderA *r, d->context->readers())
+        foreach(CuControlsReaderA *r, d->readersMap.values()) // not context->readers(), that may be shared
             r->sendData(per);
     }
 }
@@ -161,17 +818,245 @@ bool QuMultiReader::sequential() const {
 }
 
 void QuMultiReader::startRead() {
+    if(d->bp_policy == BackpressureBlock && d->unacked >= d->bp_max) {
+        d->dropped_cycles++;
+        qumr_trace(QUMR_TRACE_DEBUG, "QuMultiReader.startRead: %d cycles not acknowledged, read blocked", d->unacked);
+        return;
+    }
     if(d->idx_src_map.size() > 0) {
-        // first: returns a reference to the first value in the map, that is the value mapped to the smallest key.
-        // This function assumes that the map is not empty.
-        const QString& src0 = d->idx_src_map.first();
-        d->readersMap[src0]->sendData(CuData("read", ""));
-        cuprintf("QuMultiReader.startRead: started cycle with read command for %s...\n", qstoc(d->idx_src_map.first()));
+        if(d->pipeline_depth > 1) {
+            if(d->layout_dirty)
+                d->relayout();
+            if(d->inflight.size() >= d->pipeline_depth) {
+                qumr_trace(QUMR_TRACE_DEBUG, "QuMultiReader.startRead: %d cycles in flight, read skipped", d->inflight.size());
+                return;
+            }
+            d->inflight.append(QuMultiReaderCycle(d->databuf.size(), d->cycle_cnt + d->inflight.size() + 1, d->clock.nsecsElapsed()));
+            d->late.fill(false); // values from now on belong to the cycles in flight
+        }
+        else if(d->received_cnt == 0) { // not in the middle of a cycle
+            d->cycle_start_ns = d->clock.nsecsElapsed();
+            d->late.fill(false); // values from now on belong to the new cycle
+        }
+        if(d->deadline_ms > 0)
+            m_armDeadline();
+        // the first source of each thread (the one with the smallest index, if all the
+        // sources share the same thread) starts the sequential reading in its thread
+        if(d->starters_dirty)
+            m_updateStarters();
+        if(m_tiered()) {
+            m_startTiers();
+            return;
+        }
+        foreach(const QString& src, d->starters) {
+            d->readersMap[src]->sendData(CuData("read", ""));
+            qumr_trace(QUMR_TRACE_DEBUG, "QuMultiReader.startRead: started cycle with read command for %s...", qstoc(src));
+        }
+    }
+}
+
+/*!
+ * \brief Read only the sources at the given indexes, in SequentialManual mode
+ * \param indexes the indexes of the sources, as in insertSource
+ *
+ * The values are delivered through onNewData and onSlotUpdate as usual. When all the requested sources
+ * have been read, onPartialReadComplete is emitted with a snapshot of the requested slots only. Its *changed*
+ * flags refer to the last complete cycle, that is not affected by the partial read.
+ * onSeqReadComplete and onSnapshot are not emitted, unless a full cycle (startRead()) is in progress
+ * at the same time.
+ *
+ * The read command is sent to the thread of each requested source, and reads all the sources of that thread.
+ * The requested sources must therefore have threads of their own (setThreadPolicy, setShards, setSourcePeriod):
+ * if one of their threads also reads a source not requested, the partial read is refused with an error.
+ * Unless startRead() has started a cycle, the values read start or complete no cycle.
+ * One partial read at a time can be in progress. Changing the sources cancels it. If a cycle deadline is
+ * set (setCycleDeadline), a partial read not complete within the deadline is notified anyway, the missing
+ * values marked as stale as in a late cycle, and a new partial read can be started.
+ */
+void QuMultiReader::startRead(const QList<int> &indexes) {
+    if(d->mode != SequentialManual) {
+        perr("QuMultiReader.startRead: partial reads require SequentialManual mode");
+        return;
+    }
+    if(d->partial_left > 0) {
+        perr("QuMultiReader.startRead: a partial read is already in progress");
+        return;
+    }
+    if(d->layout_dirty)
+        d->relayout();
+    if(d->starters_dirty)
+        m_updateStarters();
+    QBitArray want(d->databuf.size()), tok(d->tokens.size());
+    foreach(int i, indexes) {
+        QHash<int, int>::const_iterator it = d->idx_pos_map.constFind(i);
+        if(it == d->idx_pos_map.constEnd())
+            perr("QuMultiReader.startRead: no source at index %d", i);
+        else {
+            want.setBit(it.value());
+            tok.setBit(d->pos_token[it.value()]);
+        }
+    }
+    // the read command reads the whole thread: refuse rather than silently read sources not requested
+    for(int p = 0; p < d->databuf.size(); p++) {
+        if(!want.testBit(p) && tok.testBit(d->pos_token[p])) {
+            perr("QuMultiReader.startRead: partial read refused: \"%s\" (index %d) is not requested but shares the thread "
+                 "of a requested source", qstoc(d->pos_src[p]), d->pos_idx[p]);
+            return;
+        }
+    }
+    d->partial_left = want.count(true);
+    if(d->partial_left == 0)
+        return;
+    d->partial_want = d->partial_wait = want;
+    d->partial_start_ns = d->clock.nsecsElapsed();
+    if(d->deadline_ms > 0) {
+        if(!d->partial_timer) {
+            d->partial_timer = new QTimer(this);
+            d->partial_timer->setSingleShot(true);
+            connect(d->partial_timer, SIGNAL(timeout()), this, SLOT(m_partialDeadline()));
+        }
+        d->partial_timer->start(d->deadline_ms);
+    }
+    for(int t = 0; t < d->tokens.size(); t++) {
+        if(tok.testBit(t)) {
+            d->readersMap[d->starters[t]]->sendData(CuData("read", ""));
+            qumr_trace(QUMR_TRACE_DEBUG, "QuMultiReader.startRead: partial read of %d sources, read command for %s...",
+                       d->partial_left, qstoc(d->starters[t]));
+        }
+    }
+}
+
+// the slot at position p has been read: notify the partial read when all the requested slots are
+void QuMultiReader::m_partialUpdate(int p) {
+    if(!d->partial_wait.testBit(p))
+        return;
+    d->partial_wait.clearBit(p);
+    if(--d->partial_left == 0) {
+        if(d->partial_timer)
+            d->partial_timer->stop();
+        emit onPartialReadComplete(d->snapshot(d->partial_want));
+    }
+}
+
+// the partial read is late: deliver it with the missing values marked as stale, as a cycle at its deadline
+void QuMultiReader::m_partialDeadline() {
+    if(d->partial_left == 0) // completed or cancelled meanwhile
+        return;
+    const int n = d->partial_want.count(true);
+    QList<int> idxs;
+    QList<CuData> l;
+    QVector<qint64> ts;
+    QBitArray ch(n);
+    idxs.reserve(n);
+    l.reserve(n);
+    ts.reserve(n);
+    for(int p = 0; p < d->databuf.size(); p++) {
+        if(!d->partial_want.testBit(p))
+            continue;
+        const bool missing = d->partial_wait.testBit(p);
+        ch.setBit(idxs.size(), !missing && d->changed.testBit(p));
+        idxs.append(d->pos_idx[p]);
+        l.append(missing ? d->stale(p) : d->databuf[p]);
+        ts.append(missing && !d->valid.testBit(p) ? 0 : d->stamps[p]);
     }
+    qumr_trace(QUMR_TRACE_INFO, "QuMultiReader.m_partialDeadline: partial read missing %d values", d->partial_left);
+    d->partial_left = 0;
+    d->partial_want = d->partial_wait = QBitArray();
+    emit onPartialReadComplete(QuMultiReaderSnapshot(idxs, l, ts, ch, d->cycle_cnt));
+}
+
+// refresh tiers are in use
+bool QuMultiReader::m_tiered() const {
+    return !d->src_period.isEmpty() && d->mode == SequentialManual && d->pipeline_depth == 1;
+}
+
+// start a cycle reading only the tiers that are due. The slots of the other tiers count
+// as already received, so that the cycle completes when the due slots are read. A tier
+// is due when its period has elapsed (5% tolerance for timer jitter) or if it has
+// slots never read
+void QuMultiReader::m_startTiers() {
+    if(d->layout_dirty)
+        d->relayout();
+    if(d->received_cnt > 0) // in the middle of a cycle: tiers already chosen
+        return;
+    const qint64 now = d->clock.nsecsElapsed();
+    const int nt = d->tokens.size();
+    QBitArray due(nt);
+    for(int t = 0; t < nt; t++) {
+        const qint64 per_ns = static_cast<qint64>(d->starter_period[t]) * 1000000;
+        due.setBit(t, per_ns <= 0 || d->starter_last_ns[t] < 0 || now - d->starter_last_ns[t] >= per_ns - per_ns / 20);
+    }
+    for(int p = 0; p < d->databuf.size(); p++)
+        if(!d->valid.testBit(p))
+            due.setBit(d->pos_token[p]);
+    for(int p = 0; p < d->databuf.size(); p++) {
+        if(!due.testBit(d->pos_token[p])) {
+            d->received.setBit(p);
+            d->received_cnt++;
+        }
+    }
+    if(d->received_cnt == d->databuf.size()) { // nothing due: no cycle
+        d->cycle_reset();
+        d->cycle_start_ns = -1;
+        return;
+    }
+    for(int t = 0; t < nt; t++) {
+        if(due.testBit(t)) {
+            d->starter_last_ns[t] = now;
+            d->readersMap[d->starters[t]]->sendData(CuData("read", ""));
+            qumr_trace(QUMR_TRACE_DEBUG, "QuMultiReader.m_startTiers: read tier %d ms starting from %s",
+                       d->starter_period[t], qstoc(d->starters[t]));
+        }
+    }
+}
+
+/*!
+ * \brief Read the source at index i with its own period, in SequentialManual mode
+ * \param i the index of the source, as in insertSource
+ * \param ms the period, in milliseconds. A value <= 0 reads the source at every cycle (the default)
+ *
+ * Sources sharing the same period form a *tier*, read in its own thread. Each cycle started by startRead
+ * (or by the fixed rate schedule, see setFixedRateSchedule) reads only the tiers whose period has elapsed.
+ * The cycle completes when the tiers read have delivered their values: onSeqReadComplete and onSnapshot
+ * carry the latest value of every source, the *changed* flags of the snapshot telling which ones have been
+ * read in the cycle. Sources never read are read at the first cycle, whatever their tier.
+ *
+ * The period of the cycles should divide the tier periods. Tiers are not used with setPipelineDepth > 1.
+ * The reader of the source is created again in the thread of its tier.
+ * The period belongs to the source: it follows the source if setSources moves it to another index, and is
+ * forgotten when the source is removed. A source must be at index i. Ignored, with an error, outside
+ * SequentialManual mode.
+ */
+void QuMultiReader::setSourcePeriod(int i, int ms) {
+    if(d->mode != SequentialManual) {
+        perr("QuMultiReader.setSourcePeriod: refresh tiers require SequentialManual mode");
+        return;
+    }
+    const QString src = d->idx_src_map.value(i);
+    if(src.isEmpty()) {
+        perr("QuMultiReader.setSourcePeriod: no source at index %d", i);
+        return;
+    }
+    if(ms == d->src_period.value(src, 0) || (ms <= 0 && !d->src_period.contains(src)))
+        return;
+    removeSource(src); // forgets the former period
+    if(ms > 0)
+        d->src_period.insert(src, ms);
+    d->starters_dirty = true;
+    m_insertSources(QList<QPair<QString, int> >() << qMakePair(src, i));
+}
+
+/*!
+ * \brief Returns the period of the source at index i, a value <= 0 if it is read at every cycle
+ *
+ * @see setSourcePeriod
+ */
+int QuMultiReader::sourcePeriod(int i) const {
+    return d->src_period.value(d->idx_src_map.value(i), 0);
 }
 
 void QuMultiReader::m_timerSetup() {
-    printf("\e[1;31mQuMultiReader.mTimerSetup period: %d\e[0m\n", d->period);
+    qumr_trace(QUMR_TRACE_INFO, "QuMultiReader.m_timerSetup period: %d", d->period);
     if(!d->timer) {
         d->timer = new QTimer(this);
         connect(d->timer, SIGNAL(timeout()), this, SLOT(startRead()));
@@ -183,35 +1068,941 @@ void QuMultiReader::m_timerSetup() {
 
 // find the index that matches src, discarding args
 int QuMultiReader::m_matchNoArgs(const QString &src) const {
-    printf("\e[1;31mQuMultiReader.m_matchNoArgs\e[0m\n");
-    foreach(int k, d->idx_src_map.keys()) {
-        const QString& s = d->idx_src_map[k];
-        printf("\e[1;36mQuMultiReader::m_matchNoArgs comparing %s with %s\e[0m\n", qstoc(s), qstoc(src));
-        if(s.section('(', 0, 0) == src.section('(', 0, 0))
-            return k;
-    }
-    return -1;
+    return d->noargs_index(src.section('(', 0, 0));
 }
 
 void QuMultiReader::onUpdate(const CuData &data) {
-    QString from = QString::fromStdString( data["src"].toString());
-    int pos;
-    const QList<QString> &srcs = d->idx_src_map.values();
-    srcs.contains(from) ? pos = d->idx_src_map.key(from) : pos = m_matchNoArgs(from);
-    emit onNewData(data);
+    const qint64 now = d->clock.nsecsElapsed();
+    const QString from = QString::fromStdString( data["src"].toString());
+    QHash<QString, int>::const_iterator it = d->src_idx_map.constFind(from);
+    const int pos = it != d->src_idx_map.constEnd() ? it.value() : m_matchNoArgs(from);
+    const bool coalesce = d->coalesce_ms > 0;
+    if(!coalesce)
+        emit onNewData(data);
     if(pos >= 0) {
-        d->databuf[pos] = data; // update or new
-        // complete data update when a single value changes may be handy in concurrent mode
-        emit onNewData(d->databuf.values());
-        if((d->mode >= SequentialReads)) {
-            const QList<int> &dkeys = d->databuf.keys();
-            const QList<int> &idxli = d->idx_src_map.keys();
-            if(dkeys == idxli) { // databuf complete
-                emit onSeqReadComplete(d->databuf.values()); // Returns all the values in the map, in ascending order of their keys
-                d->databuf.clear();
+        if(d->layout_dirty)
+            d->relayout();
+        const int p = d->idx_pos_map.value(pos);
+        // in SequentialManual mode, cycles are started by startRead only. Values arriving while none is in
+        // progress (read by a partial read, or late) update the buffer but are not part of a cycle
+        bool outside = d->mode == SequentialManual &&
+                (d->pipeline_depth > 1 ? d->inflight.isEmpty() : d->cycle_start_ns < 0);
+        if(d->pipeline_depth == 1 && d->late.testBit(p)) {
+            // its cycle has been closed at the deadline: the value updates the buffer, not the next cycle
+            d->late.clearBit(p);
+            d->late_drops++;
+            outside = true;
+        }
+        if(d->mode >= SequentialReads) { // concurrent mode has no cycles, hence no arrival offsets
+            if(d->cycle_start_ns < 0 && !outside) // cycle not started by startRead: starts with its first value
+                d->cycle_start_ns = now;
+            if(!outside)
+                d->arrival[p] = now - d->cycle_start_ns;
+            else if(d->partial_start_ns >= 0)
+                d->arrival[p] = now - d->partial_start_ns;
+        }
+        if(d->last_upd_ns[p] >= 0)
+            d->interval_hist[p].record(now - d->last_upd_ns[p]);
+        d->last_upd_ns[p] = now;
+        d->upd_cnt[p]++;
+        d->updates++;
+        if(data["err"].toBool()) {
+            d->err_cnt[p]++;
+            d->errors++;
+        }
+        d->databuf[p] = data; // update or new
+        d->stamps[p] = QDateTime::currentMSecsSinceEpoch();
+        d->valid.setBit(p);
+        d->changed.setBit(p);
+        if(coalesce)
+            d->flush_changed.setBit(p);
+        if(!outside && !d->received.testBit(p)) {
+            d->received.setBit(p);
+            d->received_cnt++;
+        }
+        if(coalesce) {
+            // last value wins: notification is deferred to m_coalescedFlush
+            if(!d->flush_timer->isActive())
+                d->flush_timer->start();
+        }
+        else {
+            // the single slot that changed, for clients that do not need the whole list
+            emit onSlotUpdate(pos, d->databuf[p]);
+            // complete data update when a single value changes may be handy in concurrent mode.
+            // Building the list is expensive: skip it if nobody is listening
+            if(isSignalConnected(m_newDataListSignal()))
+                emit onNewData(d->values(d->received));
+        }
+        if(d->mode >= SequentialReads) {
+            if(d->partial_left > 0) // either a partial read alone or a full cycle may read the requested slots
+                m_partialUpdate(p);
+            if(!outside) {
+                if(d->pipeline_depth > 1)
+                    m_pipelineUpdate(p, data, now);
+                else if(d->received_cnt == d->databuf.size()) { // databuf complete
+                    d->cycle_cnt++;
+                    m_emitCycle(d->snapshot(d->received), d->cycle_start_ns, now);
+                    d->cycle_start_ns = -1;
+                    d->cycle_reset();
+                    d->changed.fill(false);
+                }
+                if(d->deadline_ms > 0)
+                    m_armDeadline();
+            }
+        }
+        else {
+            if(!coalesce && isSignalConnected(m_snapshotSignal())) {
+                d->cycle_cnt++;
+                emit onSnapshot(d->snapshot(d->received));
+                d->changed.fill(false);
+            }
+            if(!d->fresh.testBit(p)) {
+                d->fresh.setBit(p);
+                d->fresh_cnt++;
             }
+            if(d->fresh_cnt == d->databuf.size())
+                m_freshBarrier();
+            if(d->align_ms > 0)
+                m_alignUpdate(p, data, now);
+        }
+    }
+    // includes the time spent by the receivers directly connected
+    d->proc_hist.record(d->clock.nsecsElapsed() - now);
+}
+
+// concurrent mode: every slot has been updated since the last barrier
+void QuMultiReader::m_freshBarrier() {
+    d->barrier_cnt++;
+    if(isSignalConnected(m_allFreshSignal()))
+        emit onAllFresh(d->snapshot(d->fresh, d->fresh, d->barrier_cnt)); // all fresh, all changed
+    d->fresh.fill(false);
+    d->fresh_cnt = 0;
+}
+
+/*!
+ * \brief Share the readers with the other multi readers reading the same sources (concurrent mode)
+ * \param share true to share, false (the default) to have readers of its own
+ *
+ * Shared readers are kept in a process wide, reference counted registry: a source read by several multi readers
+ * with sharing enabled is subscribed to once, and each update is delivered to all of them. A multi reader added
+ * later receives the last value as soon as control returns to the event loop. The reader is disposed when the last multi reader removes the source.
+ *
+ * Must be called before the sources are set. Since the reader is shared, sendData reaches all the multi readers
+ * reading the source. Sequential modes keep readers of their own, because each multi reader drives its cycles.
+ */
+void QuMultiReader::setReaderSharing(bool share) {
+    if(share && d->mode != ConcurrentReads) {
+        perr("QuMultiReader.setReaderSharing: reader sharing requires ConcurrentReads mode");
+        return;
+    }
+    if(!d->idx_src_map.isEmpty()) {
+        perr("QuMultiReader.setReaderSharing: call setReaderSharing before setting the sources");
+        return;
+    }
+    d->shared = share;
+}
+
+/*!
+ * \brief Returns true if the readers are shared with the other multi readers
+ *
+ * @see setReaderSharing
+ */
+bool QuMultiReader::readerSharing() const {
+    return d->shared;
+}
+
+/*!
+ * \brief Group the values by acquisition time instead of arrival order (concurrent mode)
+ * \param window_ms values whose timestamps are within window_ms from the first value of a bucket
+ *        belong to that bucket. A value <= 0 disables the grouping (the default)
+ * \param timeout_ms a bucket not complete timeout_ms after it has been opened is emitted as it is
+ *
+ * Each update is placed in the bucket of its "timestamp_ms" (its time of arrival if the engine does not
+ * provide it). When a bucket has a value for every slot, it is emitted through onAlignedSnapshot,
+ * together with the older buckets, in timestamp order. Incomplete buckets are emitted at their timeout, carrying only
+ * the slots received, together with the older buckets. If a slot is updated twice within the same bucket, the latest
+ * value wins.
+ *
+ * The snapshot timestamps are the acquisition timestamps, the cycle number the bucket sequence number.
+ * At most 16 buckets are open at a time: the oldest is emitted when a new one would exceed the limit. A value
+ * older than all the open buckets is then emitted alone. Buckets are emitted in timestamp order: a value older than
+ * the last bucket emitted is not aligned (it is still notified through onNewData and onSlotUpdate), and counted
+ * in the "aligned_late" statistics.
+ * Changing the sources discards the open buckets.
+ */
+void QuMultiReader::setTimeAlignment(int window_ms, int timeout_ms) {
+    if(window_ms > 0 && d->mode != ConcurrentReads) {
+        perr("QuMultiReader.setTimeAlignment: time alignment requires ConcurrentReads mode");
+        return;
+    }
+    d->align_ms = window_ms;
+    d->align_timeout_ms = qMax(0, timeout_ms);
+    if(window_ms > 0 && !d->align_timer) {
+        d->align_timer = new QTimer(this);
+        d->align_timer->setSingleShot(true);
+        connect(d->align_timer, SIGNAL(timeout()), this, SLOT(m_alignTimeout()));
+    }
+    else if(window_ms <= 0) {
+        while(!d->buckets.isEmpty()) // do not lose pending values
+            m_emitBucket(d->buckets.takeFirst());
+        if(d->align_timer)
+            d->align_timer->stop();
+    }
+}
+
+/*!
+ * \brief Returns the time alignment window, in milliseconds, a value <= 0 if disabled
+ *
+ * @see setTimeAlignment
+ */
+int QuMultiReader::timeAlignmentWindow() const {
+    return d->align_ms;
+}
+
+// place the value of the slot at position p in the bucket of its acquisition time
+void QuMultiReader::m_alignUpdate(int p, const CuData &data, qint64 now) {
+    const qint64 ts = data.containsKey("timestamp_ms") ? data["timestamp_ms"].toLongInt() : d->stamps[p];
+    if(ts < d->bucket_last_t0_ms) { // a newer bucket has already been emitted
+        d->bucket_late++;
+        return;
+    }
+    int b = 0;
+    while(b < d->buckets.size() && d->buckets[b].t0_ms + d->align_ms < ts)
+        b++;
+    if(b == d->buckets.size() || ts < d->buckets[b].t0_ms - d->align_ms) { // no bucket for ts: open one, in order
+        if(d->buckets.size() == 16 && b == 0) { // older than all the open buckets: emitted alone, right away
+            QuMultiReaderBucket k(d->databuf.size(), 0, now, ts);
+            k.values[p] = data;
+            k.stamps[p] = ts;
+            k.received.setBit(p);
+            k.received_cnt = 1;
+            m_emitBucket(k);
+            return;
+        }
+        if(d->buckets.size() == 16) {
+            m_emitBucket(d->buckets.takeFirst());
+            b--;
+        }
+        d->buckets.insert(b, QuMultiReaderBucket(d->databuf.size(), 0, now, ts));
+    }
+    QuMultiReaderBucket& k = d->buckets[b];
+    k.values[p] = data;
+    k.stamps[p] = ts;
+    if(!k.received.testBit(p)) {
+        k.received.setBit(p);
+        k.received_cnt++;
+    }
+    if(k.received_cnt == d->databuf.size()) // complete: emit it and the older ones, in order
+        for(int i = 0; i <= b; i++)
+            m_emitBucket(d->buckets.takeFirst());
+    m_armAlignTimer();
+}
+
+// arm the timer on the timeout of the first bucket to expire
+void QuMultiReader::m_armAlignTimer() {
+    qint64 first = -1;
+    foreach(const QuMultiReaderBucket& k, d->buckets)
+        if(first < 0 || k.start_ns < first)
+            first = k.start_ns;
+    if(first < 0)
+        d->align_timer->stop();
+    else {
+        const qint64 left_ms = d->align_timeout_ms - (d->clock.nsecsElapsed() - first) / 1000000;
+        d->align_timer->start(static_cast<int>(qMax(Q_INT64_C(0), left_ms)));
+    }
+}
+
+// emit the buckets expired, with the values received, and the older ones, in timestamp order
+void QuMultiReader::m_alignTimeout() {
+    if(d->layout_dirty)
+        d->relayout();
+    const qint64 now = d->clock.nsecsElapsed();
+    int last = -1;
+    for(int b = 0; b < d->buckets.size(); b++)
+        if((now - d->buckets[b].start_ns) / 1000000 >= d->align_timeout_ms)
+            last = b;
+    for(int i = 0; i <= last; i++)
+        m_emitBucket(d->buckets.takeFirst());
+    m_armAlignTimer();
+}
+
+void QuMultiReader::m_emitBucket(const QuMultiReaderBucket &k) {
+    d->bucket_cnt++;
+    d->bucket_last_t0_ms = k.t0_ms;
+    if(k.received_cnt < k.values.size())
+        d->bucket_incomplete++;
+    if(!isSignalConnected(m_alignedSnapshotSignal()))
+        return;
+    QList<int> idxs;
+    QList<CuData> vals;
+    QVector<qint64> ts;
+    idxs.reserve(k.received_cnt);
+    vals.reserve(k.received_cnt);
+    ts.reserve(k.received_cnt);
+    for(int p = 0; p < k.values.size(); p++)
+        if(k.received.testBit(p)) {
+            idxs.append(d->pos_idx[p]);
+            vals.append(k.values[p]);
+            ts.append(k.stamps[p]);
+        }
+    QBitArray ch(idxs.size(), true);
+    emit onAlignedSnapshot(QuMultiReaderSnapshot(idxs, vals, ts, ch, d->bucket_cnt));
+}
+
+// account for the duration of a complete cycle and notify it, unless the consumer
+// is behind (see setBackpressure)
+void QuMultiReader::m_emitCycle(const QuMultiReaderSnapshot &snap, qint64 start_ns, qint64 now) {
+    d->last_cycle_start_ns = start_ns;
+    d->last_cycle_end_ns = now;
+    d->last_cycle_start_ms = QDateTime::currentMSecsSinceEpoch() - (now - start_ns) / 1000000;
+    d->cycle_hist.record(now - start_ns);
+    const double dur_ms = (now - start_ns) / 1e6;
+    d->cycle_ewma_ms = d->cycle_ewma_ms < 0 ? dur_ms : 0.8 * d->cycle_ewma_ms + 0.2 * dur_ms;
+    if(d->adapt_load > 0)
+        m_adaptPeriod();
+    if(d->bp_policy != BackpressureNone && d->unacked >= d->bp_max) {
+        if(d->bp_policy == BackpressureDropOldest) { // the latest cycle waits for acknowledge, replacing an older one
+            if(d->bp_held.isValid())
+                d->dropped_cycles++;
+            d->bp_held = snap;
+        }
+        else
+            d->dropped_cycles++;
+        qumr_trace(QUMR_TRACE_DEBUG, "QuMultiReader.m_emitCycle: %d cycles not acknowledged, cycle %llu %s", d->unacked,
+                   static_cast<unsigned long long>(snap.cycle()), d->bp_policy == BackpressureDropOldest ? "held" : "dropped");
+    }
+    else
+        m_deliverCycle(snap);
+    if(d->sched_pending) { // catch up a tick missed while this cycle was in progress
+        d->sched_pending = false;
+        QMetaObject::invokeMethod(this, "startRead", Qt::QueuedConnection);
+    }
+}
+
+// notify a cycle. All the values, in ascending order of their indexes. Both signals share the same list
+void QuMultiReader::m_deliverCycle(const QuMultiReaderSnapshot &snap) {
+    if(d->bp_policy != BackpressureNone)
+        d->unacked++;
+    if(isSignalConnected(m_snapshotSignal()))
+        emit onSnapshot(snap);
+    emit onSeqReadComplete(snap.values());
+}
+
+/*!
+ * \brief Bound the number of cycles notified and not yet processed by the consumer (sequential modes)
+ * \param policy one of QuMultiReaderPluginInterface::BackpressurePolicy. BackpressureNone (the default)
+ *        notifies every cycle
+ * \param max_unacked the maximum number of cycles notified and not acknowledged (at least 1)
+ *
+ * The consumer calls acknowledge when it has processed a cycle (onSeqReadComplete, onSnapshot).
+ * When max_unacked cycles are waiting for acknowledgement:
+ * \li BackpressureSkip: complete cycles are not notified
+ * \li BackpressureDropOldest: the latest complete cycle is held back, replacing an older one, and notified
+ *     on the next acknowledge
+ * \li BackpressureBlock: startRead does not start new cycles. In SequentialReads mode, where cycles are
+ *     started by the engine poller, and for cycles already in flight, it acts as BackpressureSkip
+ *
+ * This keeps a slow receiver, connected through a queued connection, from accumulating events and memory.
+ * Dropped cycles and cycles not started are counted in stats ("dropped_cycles").
+ */
+void QuMultiReader::setBackpressure(int policy, int max_unacked) {
+    d->bp_policy = policy;
+    d->bp_max = qMax(1, max_unacked);
+    d->unacked = 0;
+    if(d->bp_held.isValid()) { // never left behind
+        const QuMultiReaderSnapshot held = d->bp_held;
+        d->bp_held = QuMultiReaderSnapshot();
+        m_deliverCycle(held);
+    }
+}
+
+/*!
+ * \brief Returns the backpressure policy, one of QuMultiReaderPluginInterface::BackpressurePolicy
+ *
+ * @see setBackpressure
+ */
+int QuMultiReader::backpressurePolicy() const {
+    return d->bp_policy;
+}
+
+/*!
+ * \brief Tell the multi reader that the consumer has processed a cycle
+ *
+ * With BackpressureDropOldest, a cycle held back is notified right away, from within this call.
+ *
+ * @see setBackpressure
+ */
+void QuMultiReader::acknowledge() {
+    if(d->unacked > 0)
+        d->unacked--;
+    if(d->bp_held.isValid() && d->unacked < d->bp_max) {
+        const QuMultiReaderSnapshot held = d->bp_held;
+        d->bp_held = QuMultiReaderSnapshot();
+        m_deliverCycle(held);
+    }
+}
+
+/*!
+ * \brief Start read cycles at fixed rate, aligned to the wall clock (SequentialManual mode)
+ * \param period_ms the period, in milliseconds. A value <= 0 stops the schedule
+ * \param phase_ms offset of the ticks: cycles start when the time since the epoch, in ms, modulo period_ms
+ *        equals phase_ms. For example period_ms 1000 and phase_ms 0 start a cycle on every second
+ * \param policy one of QuMultiReaderPluginInterface::OverrunPolicy: what to do when a tick finds the previous
+ *        cycle still in progress. OverrunSkip skips the tick, OverrunCatchUp starts a cycle as soon as the
+ *        previous completes. Ticks are never accumulated: after a long stall, at most one cycle catches up
+ *
+ * Unlike a timer restarted after each cycle, the ticks do not drift: the rate is exactly 1 / period_ms
+ * whatever the duration of the cycles. Ticks finding a cycle in progress, or lost because the event
+ * loop was busy, are counted as overruns (see stats).
+ */
+void QuMultiReader::setFixedRateSchedule(int period_ms, int phase_ms, int policy) {
+    if(period_ms > 0 && d->mode != SequentialManual) {
+        perr("QuMultiReader.setFixedRateSchedule: fixed rate scheduling requires SequentialManual mode");
+        return;
+    }
+    d->sched_period_ms = period_ms;
+    d->sched_phase_ms = period_ms > 0 ? ((phase_ms % period_ms) + period_ms) % period_ms : 0;
+    d->sched_policy = policy;
+    d->sched_pending = false;
+    if(period_ms > 0) {
+        if(!d->sched_timer) {
+            d->sched_timer = new QTimer(this);
+            d->sched_timer->setSingleShot(true);
+            d->sched_timer->setTimerType(Qt::PreciseTimer);
+            connect(d->sched_timer, SIGNAL(timeout()), this, SLOT(m_scheduledTick()));
+        }
+        d->sched_next_ms = -1;
+        if(d->stagger) // calls m_setPhase, that arms the timer
+            QuMultiReaderPhaseScheduler::instance()->join(this, period_ms);
+        else
+            m_scheduleNext();
+    }
+    else {
+        if(d->sched_timer)
+            d->sched_timer->stop();
+        if(d->stagger)
+            QuMultiReaderPhaseScheduler::instance()->leave(this);
+    }
+}
+
+/*!
+ * \brief Spread the cycles of the multi readers sharing the same fixed rate period evenly across the period
+ * \param stagger true: the phase of the fixed rate schedule is assigned by a process wide scheduler,
+ *        false (the default): the phase passed to setFixedRateSchedule is used
+ *
+ * With n multi readers staggered on the same period, the k-th starts its cycles at phase k * period / n,
+ * instead of all of them hitting the same servers at the same time. Phases are spread again when a
+ * multi reader joins or leaves the group (setFixedRateSchedule, destruction).
+ *
+ * @see setFixedRateSchedule
+ */
+void QuMultiReader::setPhaseStaggering(bool stagger) {
+    if(stagger == d->stagger)
+        return;
+    d->stagger = stagger;
+    if(d->sched_period_ms > 0) {
+        if(stagger)
+            QuMultiReaderPhaseScheduler::instance()->join(this, d->sched_period_ms);
+        else
+            QuMultiReaderPhaseScheduler::instance()->leave(this); // keeps the last phase assigned
+    }
+}
+
+/*!
+ * \brief Returns true if the phase of the fixed rate schedule is assigned by the process wide scheduler
+ *
+ * @see setPhaseStaggering
+ */
+bool QuMultiReader::phaseStaggering() const {
+    return d->stagger;
+}
+
+// called by QuMultiReaderPhaseScheduler
+void QuMultiReader::m_setPhase(int phase_ms) {
+    qumr_trace(QUMR_TRACE_INFO, "QuMultiReader.m_setPhase: period %d phase %d", d->sched_period_ms, phase_ms);
+    d->sched_phase_ms = phase_ms;
+    d->sched_next_ms = -1;
+    m_scheduleNext();
+}
+
+/*!
+ * \brief Returns the period of the fixed rate schedule, a value <= 0 if not scheduled
+ *
+ * @see setFixedRateSchedule
+ */
+int QuMultiReader::fixedRatePeriod() const {
+    return d->sched_period_ms;
+}
+
+// arm the timer on the first aligned tick after the current time
+void QuMultiReader::m_scheduleNext() {
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const qint64 per = d->sched_period_ms;
+    const qint64 next = ((now - d->sched_phase_ms) / per + 1) * per + d->sched_phase_ms;
+    if(d->sched_next_ms > 0 && next - d->sched_next_ms > per) // ticks lost while the event loop was busy
+        d->overruns += (next - d->sched_next_ms) / per - 1;
+    d->sched_next_ms = next;
+    d->sched_timer->start(static_cast<int>(next - now));
+}
+
+void QuMultiReader::m_scheduledTick() {
+    const bool busy = d->pipeline_depth > 1 ? d->inflight.size() >= d->pipeline_depth : d->cycle_start_ns >= 0;
+    if(busy) {
+        d->overruns++;
+        if(d->sched_policy == OverrunCatchUp)
+            d->sched_pending = true;
+        qumr_trace(QUMR_TRACE_DEBUG, "QuMultiReader.m_scheduledTick: overrun, previous cycle in progress (%s)",
+                   d->sched_policy == OverrunCatchUp ? "catch up" : "skip");
+    }
+    else
+        startRead();
+    m_scheduleNext();
+}
+
+// choose the period so that the average cycle takes adapt_load of it. Small corrections
+// (within 10%) are not applied, to avoid reconfiguring the readers at every cycle
+void QuMultiReader::m_adaptPeriod() {
+    if(d->mode != SequentialReads || d->cycle_ewma_ms < 0)
+        return;
+    const int target = qBound(d->adapt_min_ms, qRound(d->cycle_ewma_ms / d->adapt_load), d->adapt_max_ms);
+    if(d->period <= 0 || qAbs(target - d->period) * 10 > d->period) {
+        qumr_trace(QUMR_TRACE_INFO, "QuMultiReader.m_adaptPeriod: cycle %.1fms, period %d --> %d ms",
+                   d->cycle_ewma_ms, d->period, target);
+        setPeriod(target);
+    }
+}
+
+/*!
+ * \brief Let the multi reader tune the period according to the measured cycle duration
+ * \param target_load the desired fraction of the period spent reading, in (0, 1], for example 0.6.
+ *        A value <= 0 disables adaptation (the default): the period is left as it is.
+ * \param min_ms the minimum period, in milliseconds
+ * \param max_ms the maximum period, in milliseconds
+ *
+ * In SequentialReads mode, after each cycle, the period is set to the moving average of the cycle duration
+ * divided by target_load, within [min_ms, max_ms]. Reads no longer pile up when the cycle takes longer than
+ * expected, and the values are refreshed faster when the cycle is short.
+ * The period in use is returned by period(). An explicit setPeriod is overridden at the next adjustment.
+ */
+void QuMultiReader::setAdaptivePeriod(double target_load, int min_ms, int max_ms) {
+    if(target_load > 0 && (min_ms <= 0 || max_ms < min_ms)) {
+        perr("QuMultiReader.setAdaptivePeriod: need 0 < min_ms <= max_ms (%d, %d)", min_ms, max_ms);
+        return;
+    }
+    d->adapt_load = qMin(target_load, 1.0);
+    d->adapt_min_ms = min_ms;
+    d->adapt_max_ms = max_ms;
+    if(d->adapt_load > 0)
+        m_adaptPeriod();
+}
+
+/*!
+ * \brief Returns the target load of the adaptive period, a value <= 0 if adaptation is disabled
+ *
+ * @see setAdaptivePeriod
+ */
+double QuMultiReader::adaptivePeriodLoad() const {
+    return d->adapt_load;
+}
+
+// store the value of the slot at position p into the oldest cycle in flight still waiting for it,
+// opening a new cycle if none is. Complete cycles are then notified in order
+void QuMultiReader::m_pipelineUpdate(int p, const CuData &data, qint64 now) {
+    if(d->late.testBit(p)) { // its cycle has already been notified
+        d->late.clearBit(p);
+        d->late_drops++;
+        return;
+    }
+    const int n = d->databuf.size();
+    int f = 0;
+    while(f < d->inflight.size() && d->inflight[f].received.testBit(p))
+        f++;
+    if(f == d->inflight.size()) {
+        if(d->inflight.size() < d->pipeline_depth)
+            d->inflight.append(QuMultiReaderCycle(n, d->cycle_cnt + d->inflight.size() + 1, now));
+        else { // window full: the newest cycle gets the latest value
+            f = d->inflight.size() - 1;
+            d->pipeline_overwrites++;
+        }
+    }
+    QuMultiReaderCycle& c = d->inflight[f];
+    d->arrival[p] = now - c.start_ns;
+    c.values[p] = data;
+    c.stamps[p] = d->stamps[p];
+    if(!c.received.testBit(p)) {
+        c.received.setBit(p);
+        c.received_cnt++;
+    }
+    m_pipelineFlush(now);
+}
+
+// notify the complete cycles at the head of the pipeline, in order
+void QuMultiReader::m_pipelineFlush(qint64 now) {
+    while(!d->inflight.isEmpty() && d->inflight.first().received_cnt == d->databuf.size()) {
+        const QuMultiReaderCycle done = d->inflight.takeFirst();
+        d->cycle_cnt = done.seq;
+        m_emitCycle(d->snapshot(done), done.start_ns, now);
+        d->cycle_reset();
+    }
+}
+
+/*!
+ * \brief Set a deadline for each sequential read cycle
+ * \param ms the maximum duration of a cycle, in milliseconds. A value <= 0 disables the deadline (the default)
+ * \param policy what to deliver in place of the missing values, one of QuMultiReaderPluginInterface::DeadlinePolicy
+ *
+ * If a cycle is not complete within ms milliseconds from its start, it is notified anyway through
+ * onSnapshot and onSeqReadComplete. Missing values carry the "stale" key set to true and, according to policy,
+ * either only "src", "err" and "msg" (DeadlineMarkStale) or the last value received for the source
+ * (DeadlineLastValue). In the snapshot, their *changed* flag is false. The next value of each missing source is
+ * considered late: it updates the buffer but is not counted in the next cycle, unless startRead begins a new
+ * cycle first (see also setPipelineDepth). Partial reads (startRead(const QList<int>&)) are bounded by the same deadline.
+ * The multi reader does not start a cycle itself: the next one starts as usual, with the next startRead
+ * call, fixed rate tick (setFixedRateSchedule) or poll, so that a manual reader never reads on its own.
+ */
+void QuMultiReader::setCycleDeadline(int ms, int policy) {
+    d->deadline_ms = ms;
+    d->deadline_policy = policy;
+    if(ms > 0 && !d->deadline_timer) {
+        d->deadline_timer = new QTimer(this);
+        d->deadline_timer->setSingleShot(true);
+        connect(d->deadline_timer, SIGNAL(timeout()), this, SLOT(m_cycleDeadline()));
+    }
+    d->deadline_armed_ns = -1;
+    if(ms > 0)
+        m_armDeadline();
+    else if(d->deadline_timer)
+        d->deadline_timer->stop();
+    if(ms <= 0 && d->partial_timer)
+        d->partial_timer->stop();
+}
+
+/*!
+ * \brief Returns the cycle deadline in milliseconds, a value <= 0 if disabled
+ *
+ * @see setCycleDeadline
+ */
+int QuMultiReader::cycleDeadline() const {
+    return d->deadline_ms;
+}
+
+// start of the oldest cycle in progress, -1 if none
+qint64 QuMultiReader::m_oldestCycleStart() const {
+    if(d->pipeline_depth > 1)
+        return d->inflight.isEmpty() ? -1 : d->inflight.first().start_ns;
+    return d->cycle_start_ns;
+}
+
+// (re)arm the deadline timer on the oldest cycle in progress, if it changed
+void QuMultiReader::m_armDeadline() {
+    const qint64 start = m_oldestCycleStart();
+    if(start == d->deadline_armed_ns)
+        return;
+    d->deadline_armed_ns = start;
+    if(start < 0)
+        d->deadline_timer->stop();
+    else {
+        const qint64 left_ms = d->deadline_ms - (d->clock.nsecsElapsed() - start) / 1000000;
+        d->deadline_timer->start(static_cast<int>(qMax(Q_INT64_C(0), left_ms)));
+    }
+}
+
+// the oldest cycle is late: deliver it with the missing values marked as stale
+void QuMultiReader::m_cycleDeadline() {
+    if(d->layout_dirty)
+        d->relayout();
+    const qint64 now = d->clock.nsecsElapsed();
+    if(d->pipeline_depth > 1 && !d->inflight.isEmpty()) {
+        const QuMultiReaderCycle late = d->inflight.takeFirst();
+        d->late |= ~late.received; // values still to come belong to the closed cycle
+        d->cycle_cnt = late.seq;
+        d->deadline_misses++;
+        qumr_trace(QUMR_TRACE_INFO, "QuMultiReader.m_cycleDeadline: cycle %llu missing %d values",
+                   static_cast<unsigned long long>(late.seq), d->databuf.size() - late.received_cnt);
+        m_emitCycle(d->snapshot(late), late.start_ns, now);
+        d->cycle_reset();
+        m_pipelineFlush(now);
+    }
+    else if(d->pipeline_depth == 1 && d->cycle_start_ns >= 0 && d->received_cnt < d->databuf.size()) {
+        QuMultiReaderCycle late(0, d->cycle_cnt + 1, d->cycle_start_ns);
+        late.values = d->databuf;
+        late.stamps = d->stamps;
+        late.received = d->received;
+        late.received_cnt = d->received_cnt;
+        late.changed = d->changed;
+        d->late |= ~late.received; // values still to come belong to the closed cycle
+        d->cycle_cnt = late.seq;
+        d->deadline_misses++;
+        qumr_trace(QUMR_TRACE_INFO, "QuMultiReader.m_cycleDeadline: cycle %llu missing %d values",
+                   static_cast<unsigned long long>(late.seq), d->databuf.size() - late.received_cnt);
+        m_emitCycle(d->snapshot(late), late.start_ns, now);
+        d->cycle_start_ns = -1;
+        d->cycle_reset();
+        d->changed.fill(false);
+    }
+    d->deadline_armed_ns = -1;
+    m_armDeadline(); // for the cycles still in flight
+}
+
+/*!
+ * \brief Allow up to k read cycles in flight in sequential modes
+ * \param k the maximum number of cycles in flight. 1 (the default) disables pipelining
+ *
+ * With k > 1, a value arriving for a source that has already been read in the current cycle is
+ * buffered in the next cycle instead of overwriting the current one, and in SequentialManual mode
+ * startRead can trigger a new cycle before the previous ones are complete. Cycles are still notified
+ * through onSeqReadComplete and onSnapshot in order.
+ * When k cycles are in flight, startRead is ignored and further values overwrite the newest cycle.
+ *
+ * Values are not tagged by the engine: each is assigned to the oldest cycle in flight still waiting for its
+ * source. When a cycle is closed at the deadline (setCycleDeadline), the next value of each source it was missing
+ * is considered late and dropped, unless startRead begins a new cycle first, so that the source does not
+ * stay one cycle behind.
+ *
+ * \note Cycles in flight are discarded when the sources change.
+ */
+void QuMultiReader::setPipelineDepth(int k) {
+    d->pipeline_depth = qMax(1, k);
+    while(d->inflight.size() > d->pipeline_depth)
+        d->inflight.removeLast();
+}
+
+/*!
+ * \brief Returns the maximum number of read cycles in flight
+ *
+ * @see setPipelineDepth
+ */
+int QuMultiReader::pipelineDepth() const {
+    return d->pipeline_depth;
+}
+
+/*!
+ * \brief Returns timing and counters collected by the multi reader
+ *
+ * The following keys are provided:
+ * \li "cycles": number of completed read cycles (sequential modes only, like the two keys below)
+ * \li "cycle_start": time the last completed cycle started, ms since the epoch. A cycle starts on startRead or,
+ *     if the readers poll autonomously, when its first value arrives
+ * \li "cycle_duration_ms": duration of the last completed cycle, from its start to the onSeqReadComplete emission
+ * \li "period_ms": the period in use, that may be tuned by setAdaptivePeriod
+ * \li "cycle_duration_avg_ms": exponential moving average of the cycle duration (weight 0.2 to the last cycle)
+ * \li "shards": the number of shards the sources are partitioned into (see setShards)
+ * \li "thread_tokens": the thread tokens in use, one per thread (see setThreadPolicy)
+ * \li "phase_ms": the phase of the fixed rate schedule (see setFixedRateSchedule and setPhaseStaggering)
+ * \li "overruns": ticks of the fixed rate schedule that found the previous cycle in progress or were lost
+ * \li "dropped_cycles", "unacknowledged_cycles": cycles dropped or not started because of the backpressure policy,
+ *     cycles notified and not acknowledged (see setBackpressure)
+ * \li "deadline_misses": number of cycles notified incomplete because of the deadline (see setCycleDeadline)
+ * \li "cycles_in_flight", "pipeline_overwrites": if setPipelineDepth > 1, the cycles in flight and the number of
+ *     values that overwrote another in the newest cycle because the window was full
+ * \li "late_values": values not counted in a cycle because theirs had been closed at the deadline
+ * \li "fresh_barriers", "fresh_slots": concurrent mode only, the number of times all the slots have been refreshed
+ *     (see onAllFresh) and the slots refreshed since the last time
+ * \li "aligned_buckets", "aligned_incomplete", "aligned_late": concurrent mode only, buckets emitted, how many of them
+ *     incomplete and values discarded because older than a bucket already emitted (see setTimeAlignment)
+ * \li "updates", "errors": total number of updates and of updates with the "err" flag set
+ * \li "srcs": the sources, in ascending order of their indexes, the following vectors refer to
+ * \li "arrival_offset_ms": per source arrival offset from the start of the cycle (last or current). -1 if never read
+ *     and always in concurrent mode, that has no cycles
+ * \li "update_count", "error_count": per source counters
+ *
+ * Distributions are kept in fixed memory, log bucketed histograms (QuMultiReaderHistogram, relative error
+ * within 12.5%). For each of them, the 50th, 99th and 99.9th percentiles, in milliseconds, are provided
+ * (-1 if no value has been recorded), with the keys suffixed by _p50_ms, _p99_ms and _p999_ms:
+ * \li "cycle_duration": duration of the read cycles (sequential modes)
+ * \li "update_processing": time spent in onUpdate, including the receivers connected directly
+ * \li "interval": per source vectors, time between two consecutive updates of the same source
+ *
+ * Counters are always collected: their cost is a few integer operations per update.
+ *
+ * @see resetStats
+ */
+CuData QuMultiReader::stats() const {
+    if(d->layout_dirty)
+        d->relayout();
+    CuData st("updates", static_cast<long int>(d->updates));
+    st["errors"] = static_cast<long int>(d->errors);
+    if(d->mode >= SequentialReads) {
+        st["cycles"] = static_cast<long int>(d->cycle_cnt);
+        st["cycle_start"] = static_cast<long int>(d->last_cycle_start_ms);
+        st["cycle_duration_ms"] = d->last_cycle_end_ns >= 0 ? (d->last_cycle_end_ns - d->last_cycle_start_ns) / 1e6 : -1.0;
+        m_putPercentiles(st, "cycle_duration", d->cycle_hist);
+        st["deadline_misses"] = static_cast<long int>(d->deadline_misses);
+        st["dropped_cycles"] = static_cast<long int>(d->dropped_cycles);
+        st["unacknowledged_cycles"] = d->unacked;
+        st["overruns"] = static_cast<long int>(d->overruns);
+        st["phase_ms"] = d->sched_phase_ms;
+        st["shards"] = d->shards;
+        std::vector<std::string> toks;
+        foreach(const QString& t, threadTokens())
+            toks.push_back(t.toStdString());
+        st["thread_tokens"] = toks;
+        st["period_ms"] = d->period;
+        st["cycle_duration_avg_ms"] = d->cycle_ewma_ms;
+        if(d->pipeline_depth > 1) {
+            st["cycles_in_flight"] = d->inflight.size();
+            st["pipeline_overwrites"] = static_cast<long int>(d->pipeline_overwrites);
+            st["late_values"] = static_cast<long int>(d->late_drops);
         }
     }
+    else {
+        st["fresh_barriers"] = static_cast<long int>(d->barrier_cnt);
+        st["fresh_slots"] = d->fresh_cnt;
+        st["aligned_buckets"] = static_cast<long int>(d->bucket_cnt);
+        st["aligned_incomplete"] = static_cast<long int>(d->bucket_incomplete);
+        st["aligned_late"] = static_cast<long int>(d->bucket_late);
+    }
+    m_putPercentiles(st, "update_processing", d->proc_hist);
+    const int n = d->databuf.size();
+    std::vector<std::string> srcs(n);
+    std::vector<double> arr(n), i50(n), i99(n), i999(n);
+    std::vector<long int> uc(n), ec(n);
+    for(int p = 0; p < n; p++) {
+        const QuMultiReaderHistogram& ih = d->interval_hist[p];
+        srcs[p] = d->idx_src_map.value(d->pos_idx[p]).toStdString();
+        arr[p] = d->arrival[p] >= 0 ? d->arrival[p] / 1e6 : -1.0;
+        uc[p] = static_cast<long int>(d->upd_cnt[p]);
+        ec[p] = static_cast<long int>(d->err_cnt[p]);
+        i50[p] = m_ms(ih.percentile(50));
+        i99[p] = m_ms(ih.percentile(99));
+        i999[p] = m_ms(ih.percentile(99.9));
+    }
+    st["srcs"] = srcs;
+    st["arrival_offset_ms"] = arr;
+    st["update_count"] = uc;
+    st["error_count"] = ec;
+    st["interval_p50_ms"] = i50;
+    st["interval_p99_ms"] = i99;
+    st["interval_p999_ms"] = i999;
+    return st;
+}
+
+/*!
+ * \brief Reset the counters and the distributions returned by stats
+ */
+void QuMultiReader::resetStats() {
+    if(d->layout_dirty)
+        d->relayout();
+    d->updates = d->errors = 0;
+    d->pipeline_overwrites = 0;
+    d->late_drops = 0;
+    d->deadline_misses = 0;
+    d->overruns = 0;
+    d->dropped_cycles = 0;
+    d->bucket_incomplete = 0;
+    d->bucket_late = 0;
+    d->upd_cnt.fill(0);
+    d->err_cnt.fill(0);
+    d->cycle_hist.reset();
+    d->proc_hist.reset();
+    for(int p = 0; p < d->interval_hist.size(); p++)
+        d->interval_hist[p].reset();
+}
+
+// ns to ms, negative values (percentile of an empty histogram) map to -1
+double QuMultiReader::m_ms(qint64 ns) {
+    return ns >= 0 ? ns / 1e6 : -1.0;
+}
+
+void QuMultiReader::m_putPercentiles(CuData &st, const std::string &name, const QuMultiReaderHistogram &h) {
+    st[name + "_p50_ms"] = m_ms(h.percentile(50));
+    st[name + "_p99_ms"] = m_ms(h.percentile(99));
+    st[name + "_p999_ms"] = m_ms(h.percentile(99.9));
+}
+
+/*!
+ * \brief Keep the last n trace records in memory instead of printing them on stdout
+ * \param n the ring buffer capacity, n <= 0 restores printing
+ *
+ * Tracing is compiled in only if the plugin is built with QUMULTIREADER_TRACE_LEVEL > 0.
+ * The buffer is shared by all the multi readers in the application.
+ */
+void QuMultiReader::setTraceBufferSize(int n) {
+    QuMultiReaderTrace::setRingBufferSize(n);
+}
+
+/*!
+ * \brief Returns the trace records kept in memory, oldest first
+ *
+ * @see setTraceBufferSize
+ */
+QStringList QuMultiReader::traceBuffer() const {
+    return QuMultiReaderTrace::ringBuffer();
+}
+
+/*!
+ * \brief Enable or disable the coalescing of the notifications
+ * \param ms the coalescing window, in milliseconds. A value <= 0 disables coalescing (the default)
+ *
+ * When coalescing is enabled, updates are merged per slot (the last value wins) and notified once per
+ * window: onNewData(const CuData&) and onSlotUpdate are not emitted, onNewData(const QList<CuData>&)
+ * is emitted with the values received so far and, in concurrent mode, onSnapshot is emitted with the
+ * *changed* flags set on the slots updated within the window.
+ * Notification of a complete read cycle in sequential modes is not affected.
+ *
+ * This is meant for graphical clients reading many sources at a rate higher than they can refresh.
+ */
+void QuMultiReader::setCoalescingWindow(int ms) {
+    d->coalesce_ms = ms;
+    if(ms > 0) {
+        if(!d->flush_timer) {
+            d->flush_timer = new QTimer(this);
+            d->flush_timer->setSingleShot(true);
+            connect(d->flush_timer, SIGNAL(timeout()), this, SLOT(m_coalescedFlush()));
+        }
+        d->flush_timer->setInterval(ms);
+    }
+    else if(d->flush_timer && d->flush_timer->isActive()) {
+        d->flush_timer->stop();
+        m_coalescedFlush(); // do not lose pending updates
+    }
+}
+
+/*!
+ * \brief Returns the coalescing window, in milliseconds, or a value <= 0 if coalescing is disabled
+ *
+ * @see setCoalescingWindow
+ */
+int QuMultiReader::coalescingWindow() const {
+    return d->coalesce_ms;
+}
+
+void QuMultiReader::m_coalescedFlush() {
+    if(d->layout_dirty)
+        d->relayout();
+    if(d->flush_changed.count(true) == 0)
+        return;
+    if(isSignalConnected(m_newDataListSignal()))
+        emit onNewData(d->values(d->received));
+    if(d->mode == ConcurrentReads) {
+        if(isSignalConnected(m_snapshotSignal())) {
+            d->cycle_cnt++;
+            emit onSnapshot(d->snapshot(d->received));
+        }
+        d->changed.fill(false);
+    } // in sequential modes, changed flags belong to the cycle snapshot
+    d->flush_changed.fill(false);
+}
+
+QMetaMethod QuMultiReader::m_newDataListSignal() {
+    static const QMetaMethod m = QMetaMethod::fromSignal(
+                static_cast<void (QuMultiReader::*)(const QList<CuData>&)>(&QuMultiReader::onNewData));
+    return m;
+}
+
+QMetaMethod QuMultiReader::m_snapshotSignal() {
+    static const QMetaMethod m = QMetaMethod::fromSignal(&QuMultiReader::onSnapshot);
+    return m;
+}
+
+QMetaMethod QuMultiReader::m_alignedSnapshotSignal() {
+    static const QMetaMethod m = QMetaMethod::fromSignal(&QuMultiReader::onAlignedSnapshot);
+    return m;
+}
+
+QMetaMethod QuMultiReader::m_allFreshSignal() {
+    static const QMetaMethod m = QMetaMethod::fromSignal(&QuMultiReader::onAllFresh);
+    return m;
 }
 
 QuMultiReaderPluginInterface *QuMultiReader::getMultiSequentialReader(QObject *parent, bool manual_refresh) {
@@ -220,7 +2011,10 @@ QuMultiReaderPluginInterface *QuMultiReader::getMultiSequentialReader(QObject *p
         perr("QuMultiReader.getMultiSequentialReader: call QuMultiReader.init before getMultiSequentialReader");
     else {
         r = new QuMultiReader(parent);
-        r->init(d->context->cumbiaPool(), d->context->getControlsFactoryPool(), manual_refresh ? SequentialManual : SequentialReads);
+        if(d->share_ctx_with_children)
+            r->m_initShared(this, manual_refresh ? SequentialManual : SequentialReads);
+        else
+            r->init(d->context->cumbiaPool(), d->context->getControlsFactoryPool(), manual_refresh ? SequentialManual : SequentialReads);
     }
     return r;
 }
@@ -231,15 +2025,67 @@ QuMultiReaderPluginInterface *QuMultiReader::getMultiConcurrentReader(QObject *p
         perr("QuMultiReader.getMultiSequentialReader: call QuMultiReader.init before getMultiSequentialReader");
     else {
         r = new QuMultiReader(parent);
-        r->init(d->context->cumbiaPool(), d->context->getControlsFactoryPool(), ConcurrentReads);
+        if(d->share_ctx_with_children)
+            r->m_initShared(this, ConcurrentReads);
+        else
+            r->init(d->context->cumbiaPool(), d->context->getControlsFactoryPool(), ConcurrentReads);
     }
     return r;
 }
 
+/*!
+ * \brief Let the multi readers created by getMultiSequentialReader and getMultiConcurrentReader share this context
+ * \param share true: children use the context of this multi reader instead of allocating their own.
+ *        false (the default): each child has its own context
+ *
+ * An application with many child multi readers saves a context and its bookkeeping per child. The context
+ * is reference counted: it is deleted with the last multi reader using it, whatever the order of destruction.
+ * Each multi reader disposes only its own readers.
+ *
+ * \note Multi readers sharing a context cannot read the same source: disposing a reader is done by source,
+ *       so removing it from one multi reader would dispose the reader of the other. A source already read by
+ *       another multi reader in the context is not added, with an error. Use setReaderSharing to share the
+ *       readers of identical sources in concurrent mode.
+ * Children already created are not affected.
+ */
+void QuMultiReader::setChildContextSharing(bool share) {
+    d->share_ctx_with_children = share;
+}
+
+/*!
+ * \brief Returns true if the child multi readers share the context of this multi reader
+ *
+ * @see setChildContextSharing
+ */
+bool QuMultiReader::childContextSharing() const {
+    return d->share_ctx_with_children;
+}
+
+// init as a child of parent, sharing its context
+void QuMultiReader::m_initShared(QuMultiReader *parent, int mode) {
+    d->ctx_ref = parent->d->ctx_ref;
+    d->context = d->ctx_ref.data();
+    d->ctx_shared = parent->d->ctx_shared = true;
+    d->mode = mode;
+    if(d->mode >= SequentialManual) d->period = -1;
+}
+
 CuContext *QuMultiReader::getContext() const {
     return d->context;
 }
 
+/*!
+ * \brief Returns the latest value of every slot that has been updated at least once
+ *
+ * The snapshot is built on demand and is not bound to the current read cycle: in sequential modes
+ * it may mix values from the last completed cycle and the one in progress.
+ */
+QuMultiReaderSnapshot QuMultiReader::snapshot() const {
+    if(d->layout_dirty)
+        d->relayout();
+    return d->snapshot(d->valid);
+}
+
 #if QT_VERSION < 0x050000
 Q_EXPORT_PLUGIN2(cumbia-multiread, QuMultiReader)
 #endif // QT_VERSION < 0x050000
@@ -3,7 +3,9 @@
 
 #include <QObject>
 #include <QList>
+#include <QPair>
 #include <qumultireaderplugininterface.h>
+#include <qumultireadersnapshot.h>
 #include <cudata.h>
 #include <cudatalistener.h>
 
@@ -13,6 +15,10 @@ class CumbiaPool;
 class CuControlsReaderFactoryI;
 class CuControlsFactoryPool;
 class CuControlsReaderA;
+class QMetaMethod;
+class QuMultiReaderHistogram;
+class QuMultiReaderPhaseScheduler;
+class QuMultiReaderBucket;
 
 /** \mainpage This plugin allows parallel and sequential reading from multiple sources
  *
@@ -88,6 +94,7 @@ public:
     void setSources(const QStringList &srcs);
     void unsetSources();
     void insertSource(const QString &src, int i);
+    void insertSources(const QStringList &srcs, int firstIndex);
     void removeSource(const QString &src);
     const QObject *get_qobject() const;
     QStringList sources() const;
@@ -100,20 +107,111 @@ public:
     QuMultiReaderPluginInterface *getMultiSequentialReader(QObject *parent, bool manual_refresh);
     QuMultiReaderPluginInterface *getMultiConcurrentReader(QObject *parent);
     CuContext *getContext() const;
+    void setChildContextSharing(bool share);
+    bool childContextSharing() const;
+    QuMultiReaderSnapshot snapshot() const;
+
+    void setCoalescingWindow(int ms);
+    int coalescingWindow() const;
+
+    void setPipelineDepth(int k);
+    int pipelineDepth() const;
+
+    void setCycleDeadline(int ms, int policy = DeadlineMarkStale);
+    int cycleDeadline() const;
+
+    void setAdaptivePeriod(double target_load, int min_ms, int max_ms);
+    double adaptivePeriodLoad() const;
+
+    void setFixedRateSchedule(int period_ms, int phase_ms = 0, int policy = OverrunSkip);
+    int fixedRatePeriod() const;
+
+    void setPhaseStaggering(bool stagger);
+    bool phaseStaggering() const;
+
+    void setShards(int n);
+    int shards() const;
+
+    void setThreadPolicy(int policy, const QString& pool_name = QString());
+    int threadPolicy() const;
+    QStringList threadTokens() const;
+
+    void setSourcePeriod(int i, int ms);
+    int sourcePeriod(int i) const;
+
+    void setReaderSharing(bool share);
+    bool readerSharing() const;
+
+    void setTimeAlignment(int window_ms, int timeout_ms);
+    int timeAlignmentWindow() const;
+
+    void setBackpressure(int policy, int max_unacked = 1);
+    int backpressurePolicy() const;
+
+    CuData stats() const;
+    void resetStats();
+
+    void setTraceBufferSize(int n);
+    QStringList traceBuffer() const;
 
 public slots:
     void startRead();
+    void startRead(const QList<int>& indexes);
+    void acknowledge();
 
 signals:
     void onNewData(const CuData& da);
     void onNewData(const QList<CuData >& data);
     void onSeqReadComplete(const QList<CuData >& data);
+    void onSnapshot(const QuMultiReaderSnapshot& snapshot);
+    void onSlotUpdate(int index, const CuData& data);
+    void onPartialReadComplete(const QuMultiReaderSnapshot& snapshot);
+    void onAllFresh(const QuMultiReaderSnapshot& snapshot);
+    void onAlignedSnapshot(const QuMultiReaderSnapshot& snapshot);
 
 private:
     QuMultiReaderPrivate *d;
 
     void m_timerSetup();
+    void m_initShared(QuMultiReader *parent, int mode);
     int m_matchNoArgs(const QString& src) const;
+    void m_insertSources(const QList<QPair<QString, int> >& srcs);
+    void m_addReaders(const QList<QPair<QString, int> >& srcs);
+    QString m_threadToken(const QString& src) const;
+    void m_recreateReaders();
+    void m_updateStarters();
+    bool m_tiered() const;
+    void m_startTiers();
+    void m_partialUpdate(int p);
+    void m_emitCycle(const QuMultiReaderSnapshot& snap, qint64 start_ns, qint64 now);
+    void m_deliverCycle(const QuMultiReaderSnapshot& snap);
+    void m_freshBarrier();
+    void m_alignUpdate(int p, const CuData& data, qint64 now);
+    void m_armAlignTimer();
+    void m_emitBucket(const QuMultiReaderBucket& k);
+    void m_pipelineUpdate(int p, const CuData& data, qint64 now);
+    void m_pipelineFlush(qint64 now);
+    qint64 m_oldestCycleStart() const;
+    void m_armDeadline();
+    void m_adaptPeriod();
+    void m_scheduleNext();
+    void m_setPhase(int phase_ms);
+
+    friend class QuMultiReaderPhaseScheduler;
+    static QMetaMethod m_newDataListSignal();
+    static QMetaMethod m_snapshotSignal();
+    static QMetaMethod m_allFreshSignal();
+    static QMetaMethod m_alignedSnapshotSignal();
+    static double m_ms(qint64 ns);
+    static void m_putPercentiles(CuData& st, const std::string& name, const QuMultiReaderHistogram& h);
+
+private slots:
+    void m_coalescedFlush();
+    void m_cycleDeadline();
+    void m_scheduledTick();
+    void m_alignTimeout();
+    void m_partialDeadline();
+    void m_replayShared();
 
     // CuDataListener interface
 public:
@@ -0,0 +1,74 @@
+#include "qumultireaderhistogram.h"
+#include <string.h>
+#include <math.h>
+
+QuMultiReaderHistogram::QuMultiReaderHistogram() {
+    reset();
+}
+
+void QuMultiReaderHistogram::record(qint64 ns) {
+    quint32& c = m_counts[m_bucket(ns)];
+    if(c < 0xFFFFFFFFu) // saturate rather than wrap
+        c++;
+    if(m_count == 0 || ns < m_min) m_min = ns;
+    if(m_count == 0 || ns > m_max) m_max = ns;
+    m_count++;
+}
+
+void QuMultiReaderHistogram::reset() {
+    memset(m_counts, 0, sizeof(m_counts));
+    m_count = 0;
+    m_min = m_max = 0;
+}
+
+/*!
+ * \brief returns the value below which the p percent of the recorded values fall
+ * \param p the percentile, in [0, 100], for example 50, 99, 99.9
+ * \return the highest value equivalent to the bucket the percentile falls in, clamped to the
+ *         recorded minimum and maximum, or -1 if the histogram is empty
+ */
+qint64 QuMultiReaderHistogram::percentile(double p) const {
+    if(m_count == 0)
+        return -1;
+    if(p <= 0) return m_min;
+    if(p >= 100) return m_max;
+    quint64 target = static_cast<quint64>(ceil(p / 100.0 * m_count));
+    quint64 cumul = 0;
+    for(int b = 0; b < Buckets; b++) {
+        cumul += m_counts[b];
+        if(cumul >= target)
+            return qBound(m_min, m_bucketUpperBound(b), m_max);
+    }
+    return m_max;
+}
+
+quint64 QuMultiReaderHistogram::count() const {
+    return m_count;
+}
+
+qint64 QuMultiReaderHistogram::min() const {
+    return m_min;
+}
+
+qint64 QuMultiReaderHistogram::max() const {
+    return m_max;
+}
+
+int QuMultiReaderHistogram::m_bucket(qint64 ns) {
+    if(ns < (Q_INT64_C(1) << MinExp))
+        return 0;
+    const int msb = 63 - __builtin_clzll(static_cast<quint64>(ns));
+    if(msb >= MaxExp)
+        return Buckets - 1;
+    const int sub = static_cast<int>((ns >> (msb - SubBits)) & (SubBuckets - 1));
+    return (msb - MinExp) * SubBuckets + sub + 1;
+}
+
+qint64 QuMultiReaderHistogram::m_bucketUpperBound(int b) {
+    if(b == 0)
+        return (Q_INT64_C(1) << MinExp) - 1;
+    const int e = (b - 1) / SubBuckets + MinExp;
+    const int sub = (b - 1) % SubBuckets;
+    const qint64 width = Q_INT64_C(1) << (e - SubBits);
+    return (Q_INT64_C(1) << e) + (sub + 1) * width - 1;
+}
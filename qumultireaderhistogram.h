@@ -0,0 +1,42 @@
+#ifndef QUMULTIREADERHISTOGRAM_H
+#define QUMULTIREADERHISTOGRAM_H
+
+#include <QtGlobal>
+
+/*!
+ * \brief Fixed memory, log bucketed histogram of durations in nanoseconds
+ *
+ * Each power of two from 2^MinExp to 2^MaxExp ns is split into 2^SubBits linear buckets, so that the
+ * relative error of a percentile is at most 1 / 2^SubBits (12.5%), whatever the magnitude.
+ * Smaller values fall in an underflow bucket, greater ones in the last bucket.
+ * Recording a value is a few integer operations and never allocates.
+ *
+ * Used by QuMultiReader to measure cycle durations, intervals between updates and processing time.
+ */
+class QuMultiReaderHistogram
+{
+public:
+    enum { SubBits = 3, MinExp = 7, MaxExp = 41,
+           SubBuckets = 1 << SubBits,
+           Buckets = (MaxExp - MinExp) * SubBuckets + 1 };
+
+    QuMultiReaderHistogram();
+
+    void record(qint64 ns);
+    void reset();
+
+    qint64 percentile(double p) const;
+    quint64 count() const;
+    qint64 min() const;
+    qint64 max() const;
+
+private:
+    quint32 m_counts[Buckets];
+    quint64 m_count;
+    qint64 m_min, m_max;
+
+    static int m_bucket(qint64 ns);
+    static qint64 m_bucketUpperBound(int b);
+};
+
+#endif // QUMULTIREADERHISTOGRAM_H
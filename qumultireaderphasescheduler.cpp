@@ -0,0 +1,38 @@
+#include "qumultireaderphasescheduler.h"
+#include "qumultireader.h"
+
+QuMultiReaderPhaseScheduler *QuMultiReaderPhaseScheduler::instance() {
+    static QuMultiReaderPhaseScheduler s;
+    return &s;
+}
+
+/*!
+ * \brief add r to the group of period_ms, leaving its former group, if any
+ */
+void QuMultiReaderPhaseScheduler::join(QuMultiReader *r, int period_ms) {
+    leave(r);
+    m_groups[period_ms].append(r);
+    m_spread(period_ms);
+}
+
+/*!
+ * \brief remove r from its group, if any. The phases of the remaining members are spread again
+ */
+void QuMultiReaderPhaseScheduler::leave(QuMultiReader *r) {
+    for(QMap<int, QList<QuMultiReader *> >::iterator it = m_groups.begin(); it != m_groups.end(); ++it) {
+        if(it.value().removeOne(r)) {
+            const int period = it.key();
+            if(it.value().isEmpty())
+                m_groups.erase(it);
+            else
+                m_spread(period);
+            return;
+        }
+    }
+}
+
+void QuMultiReaderPhaseScheduler::m_spread(int period_ms) {
+    const QList<QuMultiReader *>& g = m_groups.value(period_ms);
+    for(int k = 0; k < g.size(); k++)
+        g[k]->m_setPhase(static_cast<int>(static_cast<qint64>(k) * period_ms / g.size()));
+}
@@ -0,0 +1,35 @@
+#ifndef QUMULTIREADERPHASESCHEDULER_H
+#define QUMULTIREADERPHASESCHEDULER_H
+
+#include <QMap>
+#include <QList>
+
+class QuMultiReader;
+
+/*!
+ * \brief Spreads the cycle start times of the multi readers sharing the same period evenly across it
+ *
+ * Multi readers with a fixed rate schedule (QuMultiReader::setFixedRateSchedule) and phase staggering
+ * enabled join the group of their period. The k-th of n members of a group is given the phase
+ * k * period / n, so that their cycles do not hit the control system at the same time.
+ * Phases are assigned again whenever a member joins or leaves.
+ *
+ * Process wide. Multi readers live in the application thread, as well as the scheduler.
+ */
+class QuMultiReaderPhaseScheduler
+{
+public:
+    static QuMultiReaderPhaseScheduler *instance();
+
+    void join(QuMultiReader *r, int period_ms);
+    void leave(QuMultiReader *r);
+
+private:
+    QuMultiReaderPhaseScheduler() {}
+
+    QMap<int, QList<QuMultiReader *> > m_groups;
+
+    void m_spread(int period_ms);
+};
+
+#endif // QUMULTIREADERPHASESCHEDULER_H
@@ -4,6 +4,7 @@
 #include <QObject>
 #include <cupluginloader.h>
 #include <cumacros.h>
+#include <qumultireadersnapshot.h>
 
 class Cumbia;
 class CumbiaPool;
@@ -25,6 +26,25 @@ class CuContext;
  *     the onNewData signal. Since version 1.0.3 an additional onNewData signal handing a (const QList<CuData >&) argument
  *     has been provided and is emitted whenever a single reading has been accomplished. Clients interested in *concurrent
  *     readings* may find it useful in order to be notified as soon as one of the values monitored changes.
+ *     The list is built and the signal emitted only if at least one receiver is connected to it.
+ *
+ * \li Since version 1.1.0, the onSnapshot(const QuMultiReaderSnapshot& ) signal delivers the values as an immutable,
+ *     reference counted QuMultiReaderSnapshot, together with the per value time of arrival and the cycle sequence number.
+ *     All receivers, including those connected through queued connections, share the same data. In sequential modes,
+ *     it is emitted when a read cycle is complete, right before onSeqReadComplete. In concurrent mode, it is emitted on
+ *     every update with the values received so far. The snapshot is built only if at least one receiver is connected.
+ *
+ * \li onSlotUpdate(int index, const CuData& data) is emitted on every update with the index of the slot that changed,
+ *     as specified in insertSource, and its new data. Clients that redraw a single row in *concurrent mode* can use it
+ *     together with snapshot, that returns the latest values of all the slots on demand.
+ *
+ * \li In concurrent mode, onAllFresh(const QuMultiReaderSnapshot& ) is a freshness barrier: it is emitted as soon as
+ *     every slot has been updated at least once since the previous emission, with the latest value of all the slots.
+ *     Updates carrying an error count as fresh. The reads themselves stay concurrent.
+ *
+ * \li In SequentialManual mode, the startRead(const QList<int>& indexes) slot reads only the given slots and
+ *     emits onPartialReadComplete(const QuMultiReaderSnapshot& ) with their values when they have all been read.
+ *     The requested slots must not share a thread with the others (see setThreadPolicy).
  *
  * \li A multi reader must be initialised with the init method, that determines what is the engine used to read and whether the reading
  *     is sequential or parallel by means of the read_mode parameter. If the mode is negative, the reading is parallel and the
@@ -38,6 +58,8 @@ class CuContext;
  * only when their value changes. For example, if you monitor *n* variables and just one of them never changes, the sequential
  * read cycle would never be completed. Code that must be portable across different cumbia engines and in particular when
  * the *http module* is involved must be carefully design to avoid unexpected malfunctioning.
+ * Since version 1.1.0, setCycleDeadline bounds the duration of a cycle: when it expires, the cycle is notified with
+ * the missing values flagged as *stale*.
  *
  */
 class QuMultiReaderPluginInterface
@@ -46,6 +68,39 @@ public:
 
     enum Mode { ConcurrentReads = 0, SequentialReads, SequentialManual };
 
+    /*! \brief what a cycle notified at its deadline carries in place of the missing values (see setCycleDeadline)
+     *
+     * \li DeadlineMarkStale: "src", "err" set to true, "msg" and "stale" set to true
+     * \li DeadlineLastValue: the last value received for the source, with "stale" set to true
+     *     (as DeadlineMarkStale if the source has never been read)
+     */
+    enum DeadlinePolicy { DeadlineMarkStale = 0, DeadlineLastValue };
+
+    /*! \brief what a fixed rate schedule does when a tick finds the previous cycle in progress (see setFixedRateSchedule)
+     *
+     * \li OverrunSkip: the tick is skipped, the next cycle starts at the following tick
+     * \li OverrunCatchUp: the next cycle starts as soon as the previous one completes
+     */
+    enum OverrunPolicy { OverrunSkip = 0, OverrunCatchUp };
+
+    /*! \brief how the thread of the readers is chosen in sequential modes (see setThreadPolicy)
+     *
+     * \li ThreadShared: derived from the object name. *Multi readers without a name share the same thread*
+     * \li ThreadDedicated: one thread per multi reader
+     * \li ThreadPool: one thread per pool name, shared by the multi readers using it
+     * \li ThreadPerDevice: one thread per device, shared by the multi readers using this policy
+     */
+    enum ThreadPolicy { ThreadShared = 0, ThreadDedicated, ThreadPool, ThreadPerDevice };
+
+    /*! \brief what happens to the cycles completed while the consumer is behind (see setBackpressure)
+     *
+     * \li BackpressureNone: every cycle is notified
+     * \li BackpressureSkip: the cycle is not notified
+     * \li BackpressureDropOldest: the latest cycle is notified on the next acknowledge, older ones are dropped
+     * \li BackpressureBlock: new cycles are not started
+     */
+    enum BackpressurePolicy { BackpressureNone = 0, BackpressureSkip, BackpressureDropOldest, BackpressureBlock };
+
     virtual ~QuMultiReaderPluginInterface() { }
 
     /** \brief Initialise the multi reader with the desired engine and the read mode.
@@ -76,7 +131,9 @@ public:
 
     /** \brief set the sources to read from.
      *
-     * \note Calling this method replaces the existing sources with the new ones
+     * \note Calling this method replaces the existing sources with the new ones. Readers of the
+     *       sources already in use are kept (and re-indexed if they moved): only the sources not in
+     *       srcs are disposed and only the new ones are added.
      *
      * @see addSource
      */
@@ -89,13 +146,24 @@ public:
 
     /** \brief adds a source to the multi reader.
      *
-     * Inserts src at index position i in the list. If i <= 0, src is prepended to the list. If i >= size(),
-     * src is appended to the list.
+     * Inserts src at index position i in the list. If i < 0, src is prepended to the list. If i >= size(),
+     * src is appended to the list. Indexes are not shifted: a source already at index i is replaced
+     * and its reader disposed.
      *
      * @see setSources
      */
     virtual void insertSource(const QString& src, int i = -1) = 0;
 
+    /** \brief adds a list of sources to the multi reader.
+     *
+     * The first source is inserted at index firstIndex, the following at consecutive indexes.
+     * Equivalent to calling insertSource for each element, but reader configuration is done once
+     * for the whole list: prefer it when setting up many sources.
+     *
+     * @see insertSource
+     */
+    virtual void insertSources(const QStringList& srcs, int firstIndex = 0) = 0;
+
     /** \brief removes the specified source from the reader
      *
      */
@@ -160,12 +228,252 @@ public:
      */
     virtual QuMultiReaderPluginInterface *getMultiConcurrentReader(QObject *parent) = 0;
 
+    /*!
+     * \brief let the multi readers returned by getMultiSequentialReader and getMultiConcurrentReader share
+     *        the context of this multi reader, instead of allocating one each
+     * \param share true to share the context, false (the default) otherwise
+     *
+     * The context is reference counted and deleted with the last multi reader using it.
+     * Multi readers sharing a context cannot read the same source: a source already read by another
+     * of them is not added, and an error is printed.
+     */
+    virtual void setChildContextSharing(bool share) = 0;
+
+    /*!
+     * \brief returns true if the child multi readers share the context of this multi reader
+     */
+    virtual bool childContextSharing() const = 0;
+
     /*!
      * \brief get the context used by the multireader
      * \return a pointer to the CuContext in use, which is nullptr if init has not been called yet
      */
     virtual CuContext *getContext() const = 0;
 
+    /*!
+     * \brief get the latest value of every source that has been read at least once
+     * \return an immutable, shared QuMultiReaderSnapshot, values in ascending order of their indexes
+     */
+    virtual QuMultiReaderSnapshot snapshot() const = 0;
+
+    /*!
+     * \brief merge the updates received within a time window and notify them at once
+     * \param ms the window, in milliseconds. A value <= 0 disables coalescing
+     *
+     * When enabled, updates are merged per source (the last value wins) and notified once per window
+     * through onNewData(const QList<CuData>&) and, in concurrent mode, onSnapshot, whose *changed* flags
+     * tell which values moved. The single value signals are not emitted.
+     */
+    virtual void setCoalescingWindow(int ms) = 0;
+
+    /*!
+     * \brief returns the coalescing window in milliseconds, a value <= 0 means coalescing is disabled
+     */
+    virtual int coalescingWindow() const = 0;
+
+    /*!
+     * \brief allow up to k read cycles in flight in sequential modes
+     * \param k maximum number of cycles in flight, 1 (the default) disables pipelining
+     *
+     * A value is assigned to the oldest cycle in flight still waiting for its source, so that a source
+     * read again before the current cycle completes does not overwrite it. Cycles are notified in order.
+     * Values arriving after their cycle has been closed at the deadline are dropped.
+     * In SequentialManual mode, startRead can be called up to k times before the first cycle completes.
+     */
+    virtual void setPipelineDepth(int k) = 0;
+
+    /*!
+     * \brief returns the maximum number of read cycles in flight
+     */
+    virtual int pipelineDepth() const = 0;
+
+    /*!
+     * \brief bound the duration of sequential read cycles
+     * \param ms the deadline, in milliseconds from the start of the cycle. A value <= 0 disables it
+     * \param policy one of DeadlinePolicy: what to deliver in place of the values missing at the deadline
+     *
+     * When the deadline expires, the cycle is notified through onSnapshot and onSeqReadComplete with the
+     * missing values flagged with the "stale" key, so that a single slow or silent source does not
+     * stop the delivery of the others. The next cycle is started as usual: in SequentialManual mode,
+     * by the next startRead or fixed rate tick. The deadline also bounds partial reads (startRead(QList<int>)).
+     */
+    virtual void setCycleDeadline(int ms, int policy = DeadlineMarkStale) = 0;
+
+    /*!
+     * \brief returns the cycle deadline, in milliseconds, or a value <= 0 if disabled
+     */
+    virtual int cycleDeadline() const = 0;
+
+    /*!
+     * \brief tune the period from the measured duration of the read cycles (SequentialReads mode)
+     * \param target_load fraction of the period the cycle should take, for example 0.6. <= 0 disables tuning
+     * \param min_ms minimum period, milliseconds
+     * \param max_ms maximum period, milliseconds
+     *
+     * After each cycle the period is set to the average cycle duration divided by target_load, within
+     * [min_ms, max_ms]. period returns the value in use.
+     */
+    virtual void setAdaptivePeriod(double target_load, int min_ms, int max_ms) = 0;
+
+    /*!
+     * \brief returns the target load of the adaptive period, a value <= 0 if disabled
+     */
+    virtual double adaptivePeriodLoad() const = 0;
+
+    /*!
+     * \brief start read cycles at a fixed rate, aligned to the wall clock (SequentialManual mode only)
+     * \param period_ms the period, milliseconds. A value <= 0 stops the schedule
+     * \param phase_ms cycles start when the milliseconds since the epoch modulo period_ms equal phase_ms
+     * \param policy one of OverrunPolicy
+     *
+     * The rate does not drift with the duration of the cycles. Overruns are counted in stats.
+     */
+    virtual void setFixedRateSchedule(int period_ms, int phase_ms = 0, int policy = OverrunSkip) = 0;
+
+    /*!
+     * \brief returns the period of the fixed rate schedule, a value <= 0 if not scheduled
+     */
+    virtual int fixedRatePeriod() const = 0;
+
+    /*!
+     * \brief let a process wide scheduler assign the phase of the fixed rate schedule
+     * \param stagger true to spread the cycles of all the staggered multi readers with the same period
+     *        evenly across the period, false to use the phase given to setFixedRateSchedule
+     */
+    virtual void setPhaseStaggering(bool stagger) = 0;
+
+    /*!
+     * \brief returns true if the phase of the fixed rate schedule is assigned by the process wide scheduler
+     */
+    virtual bool phaseStaggering() const = 0;
+
+    /*!
+     * \brief partition the sources across n threads in sequential modes
+     * \param n the number of threads, QThread::idealThreadCount if n <= 0, 1 by default
+     *
+     * Each thread reads its share of the sources sequentially. The values of all the shards are merged
+     * and notified once per cycle, in ascending order of their indexes.
+     */
+    virtual void setShards(int n) = 0;
+
+    /*!
+     * \brief returns the number of threads the sources are partitioned across in sequential modes
+     */
+    virtual int shards() const = 0;
+
+    /*!
+     * \brief choose the thread the readers run in, in sequential modes
+     * \param policy one of ThreadPolicy
+     * \param pool_name the name of the pool, required by ThreadPool
+     *
+     * \note Multi readers returned by getMultiSequentialReader have no object name: unless either a name is
+     *       set or a policy other than ThreadShared is chosen, they all read in the same thread.
+     */
+    virtual void setThreadPolicy(int policy, const QString& pool_name = QString()) = 0;
+
+    /*!
+     * \brief returns the thread policy, one of ThreadPolicy
+     */
+    virtual int threadPolicy() const = 0;
+
+    /*!
+     * \brief returns the thread tokens used by this multi reader, one per thread
+     */
+    virtual QStringList threadTokens() const = 0;
+
+    /*!
+     * \brief read the source at index i with its own period (refresh tier), in SequentialManual mode
+     * \param i the index of the source
+     * \param ms the period of the source, milliseconds. <= 0: read at every cycle (the default)
+     *
+     * Each cycle reads only the tiers that are due, and is notified with the latest value of every
+     * source. The *changed* flags of the snapshot tell which sources have been read in the cycle.
+     * The period belongs to the source currently at index i and is forgotten when the source is removed.
+     */
+    virtual void setSourcePeriod(int i, int ms) = 0;
+
+    /*!
+     * \brief returns the period of the source at index i, a value <= 0 if read at every cycle
+     */
+    virtual int sourcePeriod(int i) const = 0;
+
+    /*!
+     * \brief share the readers of identical sources with the other multi readers (concurrent mode only)
+     * \param share true to subscribe once per source across all the multi readers sharing, and deliver
+     *        each update to all of them
+     *
+     * Must be called before the sources are set.
+     */
+    virtual void setReaderSharing(bool share) = 0;
+
+    /*!
+     * \brief returns true if the readers are shared with the other multi readers
+     */
+    virtual bool readerSharing() const = 0;
+
+    /*!
+     * \brief group the values by acquisition time into buckets, emitted through onAlignedSnapshot (concurrent mode only)
+     * \param window_ms values within window_ms from the timestamp of the first value of a bucket belong to it.
+     *        A value <= 0 disables the grouping
+     * \param timeout_ms incomplete buckets are emitted timeout_ms after they have been opened
+     *
+     * Complete buckets are emitted as soon as every slot has a value, in timestamp order. Values older than
+     * a bucket already emitted are not aligned.
+     */
+    virtual void setTimeAlignment(int window_ms, int timeout_ms) = 0;
+
+    /*!
+     * \brief returns the time alignment window, a value <= 0 if disabled
+     */
+    virtual int timeAlignmentWindow() const = 0;
+
+    /*!
+     * \brief bound the number of cycles notified and not yet acknowledged by the consumer (sequential modes)
+     * \param policy one of BackpressurePolicy
+     * \param max_unacked the maximum number of cycles notified and not acknowledged
+     *
+     * Dropped cycles are counted in stats.
+     */
+    virtual void setBackpressure(int policy, int max_unacked = 1) = 0;
+
+    /*!
+     * \brief returns the backpressure policy, one of BackpressurePolicy
+     */
+    virtual int backpressurePolicy() const = 0;
+
+    /*!
+     * \brief the consumer calls acknowledge when it has processed a cycle, if a backpressure policy is set
+     */
+    virtual void acknowledge() = 0;
+
+    /*!
+     * \brief returns read cycle timings and per source counters
+     * \return a CuData with the cycle start time and duration, the arrival offset of each source within
+     *         the cycle, update and error counts, 50th, 99th and 99.9th percentiles of the cycle duration,
+     *         of the update processing time and of the interval between updates of each source.
+     *         See QuMultiReader::stats for the list of keys
+     */
+    virtual CuData stats() const = 0;
+
+    /*!
+     * \brief reset the counters and the distributions returned by stats
+     */
+    virtual void resetStats() = 0;
+
+    /*!
+     * \brief keep the last n trace records in memory instead of printing them
+     * \param n the number of records to keep. n <= 0 restores printing on stdout
+     *
+     * \note Tracing is available only if the plugin has been built with QUMULTIREADER_TRACE_LEVEL > 0
+     *       (for example *qmake TRACE_LEVEL=2*). Release builds do not trace.
+     */
+    virtual void setTraceBufferSize(int n) = 0;
+
+    /*!
+     * \brief returns the trace records kept in memory, oldest first
+     */
+    virtual QStringList traceBuffer() const = 0;
+
 
     // convenience method to get the plugin instance
 
@@ -197,7 +505,9 @@ public:
     static constexpr const char file_name[32] = "libcumbia-multiread-plugin.so";
 };
 
-#define QuMultiReaderPluginInterface_iid "eu.elettra.qutils.QuMultiReaderPluginInterface"
+// the version changes with the layout of the interface: a client built against a former layout
+// must fail qobject_cast instead of calling the wrong methods
+#define QuMultiReaderPluginInterface_iid "eu.elettra.qutils.QuMultiReaderPluginInterface/1.1"
 
 Q_DECLARE_INTERFACE(QuMultiReaderPluginInterface, QuMultiReaderPluginInterface_iid)
 
@@ -0,0 +1,143 @@
+#include "qumultireaderregistry.h"
+#include "qumultireader.h"
+#include "qumultireadertrace.h"
+#include <cucontext.h>
+#include <cucontrolsreader_abs.h>
+#include <cumacros.h>
+
+QuMultiReaderRegistry *QuMultiReaderRegistry::instance() {
+    static QuMultiReaderRegistry s;
+    return &s;
+}
+
+/*!
+ * \brief subscribe r to src, creating the reader if r is the first subscriber with the same engine
+ * \param engine_ctx the context of r: a context with the same engine (Cumbia or CumbiaPool and
+ *        factories) is used to create the reader
+ * \return the shared reader, NULL if it could not be created
+ */
+CuControlsReaderA *QuMultiReaderRegistry::subscribe(QuMultiReader *r, const QString &src, CuContext *engine_ctx) {
+    void *engine = m_engine(engine_ctx);
+    QHash<Key, QString>::const_iterator a = m_aliases.constFind(Key(engine, src));
+    if(a != m_aliases.constEnd()) {
+        Entry& e = m_entries[Key(engine, a.value())];
+        if(!e.subscribers.contains(r))
+            e.subscribers.append(r);
+        qumr_trace(QUMR_TRACE_INFO, "QuMultiReaderRegistry.subscribe: %s shared by %d multi readers", qstoc(src), e.subscribers.size());
+        return e.reader;
+    }
+    Engine *eng = m_engines.value(engine);
+    if(!eng) {
+        CuContext *ctx = engine_ctx->cumbiaPool() ? new CuContext(engine_ctx->cumbiaPool(), engine_ctx->getControlsFactoryPool())
+                                                  : new CuContext(engine_ctx->cumbia(), *engine_ctx->getReaderFactoryI());
+        eng = new Engine(this, engine, ctx);
+        m_engines.insert(engine, eng);
+    }
+    CuControlsReaderA *reader = eng->ctx->add_reader(src.toStdString(), eng);
+    if(!reader) {
+        if(eng->refs == 0) {
+            m_engines.remove(engine);
+            delete eng->ctx;
+            delete eng;
+        }
+        return NULL;
+    }
+    reader->setSource(src);
+    Entry& e = m_entries[Key(engine, reader->source())];
+    e.reader = reader;
+    e.subscribers.append(r);
+    m_aliases.insert(Key(engine, src), reader->source());
+    const Key noargs(engine, reader->source().section('(', 0, 0));
+    if(!m_noargs.contains(noargs)) // like QuMultiReader::m_matchNoArgs, the first source wins
+        m_noargs.insert(noargs, reader->source());
+    eng->refs++;
+    return reader;
+}
+
+/*!
+ * \brief remove r from the subscribers of src, the reader source. The last subscriber disposes the reader
+ */
+void QuMultiReaderRegistry::unsubscribe(QuMultiReader *r, const QString &src, CuContext *engine_ctx) {
+    const Key key(m_engine(engine_ctx), src);
+    QHash<Key, Entry>::iterator it = m_entries.find(key);
+    if(it != m_entries.end() && it.value().subscribers.removeOne(r) && it.value().subscribers.isEmpty())
+        m_release(key);
+}
+
+void QuMultiReaderRegistry::unsubscribeAll(QuMultiReader *r) {
+    QList<Key> released;
+    for(QHash<Key, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+        if(it.value().subscribers.removeOne(r) && it.value().subscribers.isEmpty())
+            released << it.key();
+    foreach(const Key& key, released)
+        m_release(key);
+}
+
+/*!
+ * \brief deliver the last value of src, if any, to r, so that it does not have to wait for the next update
+ */
+void QuMultiReaderRegistry::replay(QuMultiReader *r, const QString &src, CuContext *engine_ctx) const {
+    QHash<Key, Entry>::const_iterator it = m_entries.constFind(Key(m_engine(engine_ctx), src));
+    if(it != m_entries.constEnd() && !it.value().last.isEmpty())
+        r->onUpdate(it.value().last);
+}
+
+int QuMultiReaderRegistry::subscribers(const QString &src, CuContext *engine_ctx) const {
+    void *engine = m_engine(engine_ctx);
+    return m_entries.value(Key(engine, m_aliases.value(Key(engine, src), src))).subscribers.size();
+}
+
+// the engine of a context: readers are shared only among contexts with the same engine
+void *QuMultiReaderRegistry::m_engine(CuContext *ctx) {
+    return ctx->cumbiaPool() ? static_cast<void *>(ctx->cumbiaPool()) : static_cast<void *>(ctx->cumbia());
+}
+
+// fan the update of a reader of engine out to the subscribers. Receivers may unsubscribe or destroy
+// other subscribers while notified: iterate on a copy and check each subscriber is still there.
+// The engine may deliver the source with its args: fall back to the name without them
+void QuMultiReaderRegistry::m_fanOut(void *engine, const CuData &data) {
+    Key key(engine, QString::fromStdString(data["src"].toString()));
+    QHash<Key, Entry>::iterator it = m_entries.find(key);
+    if(it == m_entries.end()) {
+        key.second = m_noargs.value(Key(engine, key.second.section('(', 0, 0)));
+        it = m_entries.find(key);
+        if(it == m_entries.end())
+            return;
+    }
+    it.value().last = data;
+    const QList<QuMultiReader *> subs = it.value().subscribers;
+    foreach(QuMultiReader *r, subs) {
+        QHash<Key, Entry>::const_iterator e = m_entries.constFind(key);
+        if(e == m_entries.constEnd())
+            break;
+        if(e.value().subscribers.contains(r))
+            r->onUpdate(data);
+    }
+}
+
+void QuMultiReaderRegistry::m_release(const Key &key) {
+    m_entries.remove(key);
+    for(QHash<Key, QString>::iterator a = m_aliases.begin(); a != m_aliases.end(); ) {
+        if(a.key().first == key.first && a.value() == key.second)
+            a = m_aliases.erase(a);
+        else
+            ++a;
+    }
+    const Key noargs(key.first, key.second.section('(', 0, 0));
+    if(m_noargs.value(noargs) == key.second) { // another source with the same name takes over, if any
+        m_noargs.remove(noargs);
+        for(QHash<Key, Entry>::const_iterator it = m_entries.constBegin(); it != m_entries.constEnd(); ++it)
+            if(it.key().first == key.first && it.key().second.section('(', 0, 0) == noargs.second) {
+                m_noargs.insert(noargs, it.key().second);
+                break;
+            }
+    }
+    Engine *eng = m_engines.value(key.first);
+    eng->ctx->disposeReader(key.second.toStdString());
+    if(--eng->refs == 0) {
+        m_engines.remove(key.first);
+        delete eng->ctx;
+        delete eng;
+    }
+    qumr_trace(QUMR_TRACE_INFO, "QuMultiReaderRegistry.m_release: reader of %s disposed", qstoc(key.second));
+}
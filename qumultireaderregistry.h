@@ -0,0 +1,72 @@
+#ifndef QUMULTIREADERREGISTRY_H
+#define QUMULTIREADERREGISTRY_H
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <cudata.h>
+#include <cudatalistener.h>
+
+class QuMultiReader;
+class CuContext;
+class CuControlsReaderA;
+
+/*!
+ * \brief Process wide, reference counted registry of the readers shared by multi readers in concurrent mode
+ *
+ * The first multi reader subscribing to a source creates its reader, in a context owned by the registry
+ * (one per engine). Further subscribers to the same source with the same engine share it: every update is
+ * fanned out to all of them, and the last value is replayed to a new subscriber. The same source read through
+ * different engines has a reader per engine. The reader is disposed when the last subscriber unsubscribes,
+ * the context when it has no readers left.
+ *
+ * Used by QuMultiReader when setReaderSharing is enabled. Lives in the application thread, as the
+ * multi readers do.
+ */
+class QuMultiReaderRegistry
+{
+public:
+    static QuMultiReaderRegistry *instance();
+
+    CuControlsReaderA *subscribe(QuMultiReader *r, const QString& src, CuContext *engine_ctx);
+    void unsubscribe(QuMultiReader *r, const QString& src, CuContext *engine_ctx);
+    void unsubscribeAll(QuMultiReader *r);
+    void replay(QuMultiReader *r, const QString& src, CuContext *engine_ctx) const;
+    int subscribers(const QString& src, CuContext *engine_ctx) const;
+
+private:
+    QuMultiReaderRegistry() {}
+
+    typedef QPair<void *, QString> Key; // engine (CumbiaPool or Cumbia), source
+
+    // the context of an engine and the listener of its readers, that tells the engine to the fan out
+    class Engine : public CuDataListener {
+    public:
+        Engine(QuMultiReaderRegistry *reg, void *engine, CuContext *ctx) : reg(reg), engine(engine), ctx(ctx), refs(0) {}
+        void onUpdate(const CuData &data) { reg->m_fanOut(engine, data); }
+        QuMultiReaderRegistry *reg;
+        void *engine;
+        CuContext *ctx;
+        int refs; // readers in ctx
+    };
+
+    class Entry {
+    public:
+        Entry() : reader(NULL) {}
+        CuControlsReaderA *reader;
+        QList<QuMultiReader *> subscribers;
+        CuData last;
+    };
+
+    QHash<Key, Entry> m_entries; // by engine and reader source
+    QHash<Key, QString> m_aliases; // engine and source as requested to reader source
+    QHash<Key, QString> m_noargs; // engine and reader source without args to reader source, for updates with args
+    QHash<void *, Engine *> m_engines;
+
+    static void *m_engine(CuContext *ctx);
+    void m_fanOut(void *engine, const CuData &data);
+    void m_release(const Key& key);
+};
+
+#endif // QUMULTIREADERREGISTRY_H
@@ -0,0 +1,96 @@
+#ifndef QUMULTIREADERSNAPSHOT_H
+#define QUMULTIREADERSNAPSHOT_H
+
+#include <QList>
+#include <QVector>
+#include <QBitArray>
+#include <QSharedPointer>
+#include <QMetaType>
+#include <cudata.h>
+
+class QuMultiReaderSnapshotData
+{
+public:
+    QuMultiReaderSnapshotData() : cycle(0) {}
+
+    QList<int> indexes;
+    QList<CuData> values;
+    QVector<qint64> timestamps;
+    QBitArray changed;
+    quint64 cycle;
+};
+
+/*!
+ * \brief An immutable, reference counted snapshot of the values read by a multi reader
+ *
+ * Copies of a snapshot share the same data: emitting it through a queued connection or
+ * handing it to several receivers costs a reference count increment, not a deep copy of
+ * the values.
+ *
+ * \li indexes: the slot index of each value, in ascending order, as specified in insertSource
+ * \li values: the data, one element per slot
+ * \li timestamps: the time of arrival of each value, in milliseconds since the epoch
+ * \li changed: one flag per value, true if the value has been updated since the previous snapshot
+ * \li cycle: the sequence number of the read cycle the snapshot refers to
+ *
+ * Snapshots are built by the multi reader only. The class is header only, so that clients
+ * do not need to link against the plugin library.
+ *
+ * @see QuMultiReaderPluginInterface
+ */
+class QuMultiReaderSnapshot
+{
+public:
+    QuMultiReaderSnapshot() {}
+
+    QuMultiReaderSnapshot(const QList<int> &indexes,
+                          const QList<CuData> &values,
+                          const QVector<qint64>& timestamps,
+                          const QBitArray& changed,
+                          quint64 cycle) {
+        QuMultiReaderSnapshotData *data = new QuMultiReaderSnapshotData;
+        data->indexes = indexes;
+        data->values = values;
+        data->timestamps = timestamps;
+        data->changed = changed;
+        data->cycle = cycle;
+        d = QSharedPointer<const QuMultiReaderSnapshotData>(data);
+    }
+
+    /*! \brief returns true if the snapshot has been built by a multi reader */
+    bool isValid() const { return !d.isNull(); }
+
+    /*! \brief the number of values in the snapshot */
+    int size() const { return d ? d->values.size() : 0; }
+
+    /*! \brief the values, in ascending order of their slot indexes */
+    QList<CuData> values() const { return d ? d->values : QList<CuData>(); }
+
+    /*! \brief the slot indexes, index i corresponding to values().at(i) */
+    QList<int> indexes() const { return d ? d->indexes : QList<int>(); }
+
+    /*! \brief per value time of arrival, in milliseconds since the epoch */
+    QVector<qint64> timestamps() const { return d ? d->timestamps : QVector<qint64>(); }
+
+    /*! \brief per value flags, true if the value changed since the previous snapshot */
+    QBitArray changed() const { return d ? d->changed : QBitArray(); }
+
+    /*! \brief the sequence number of the read cycle */
+    quint64 cycle() const { return d ? d->cycle : 0; }
+
+    /*! \brief the i-th value in the snapshot. i must be in [0, size()) */
+    const CuData& at(int i) const { return d->values.at(i); }
+
+    /*! \brief the time of arrival of the i-th value. i must be in [0, size()) */
+    qint64 timestampAt(int i) const { return d->timestamps.at(i); }
+
+    /*! \brief true if the i-th value changed since the previous snapshot. i must be in [0, size()) */
+    bool changedAt(int i) const { return d->changed.testBit(i); }
+
+private:
+    QSharedPointer<const QuMultiReaderSnapshotData> d;
+};
+
+Q_DECLARE_METATYPE(QuMultiReaderSnapshot)
+
+#endif // QUMULTIREADERSNAPSHOT_H
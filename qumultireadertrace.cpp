@@ -0,0 +1,73 @@
+#include "qumultireadertrace.h"
+#include <QVector>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDateTime>
+#include <stdarg.h>
+#include <stdio.h>
+
+class QuMultiReaderTraceRing
+{
+public:
+    QuMultiReaderTraceRing() : head(0), count(0) {}
+
+    QMutex mutex;
+    QVector<QString> records;
+    int head, count; // next write position, number of records stored
+};
+
+static QuMultiReaderTraceRing *ring() {
+    static QuMultiReaderTraceRing r;
+    return &r;
+}
+
+void QuMultiReaderTrace::trace(const char *fmt, ...) {
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    QuMultiReaderTraceRing *r = ring();
+    QMutexLocker lock(&r->mutex);
+    if(r->records.isEmpty()) {
+        printf("%s\n", buf);
+    }
+    else {
+        r->records[r->head] = QDateTime::currentDateTime().toString("hh:mm:ss.zzz ") + QString::fromLocal8Bit(buf);
+        r->head = (r->head + 1) % r->records.size();
+        if(r->count < r->records.size())
+            r->count++;
+    }
+}
+
+/*!
+ * \brief keep the last n trace records in memory instead of printing them
+ * \param n the ring buffer capacity. n <= 0 disables the ring buffer and restores printing on stdout
+ *
+ * Records already in the buffer are discarded.
+ */
+void QuMultiReaderTrace::setRingBufferSize(int n) {
+    QuMultiReaderTraceRing *r = ring();
+    QMutexLocker lock(&r->mutex);
+    r->records = QVector<QString>(n > 0 ? n : 0);
+    r->head = r->count = 0;
+}
+
+int QuMultiReaderTrace::ringBufferSize() {
+    QuMultiReaderTraceRing *r = ring();
+    QMutexLocker lock(&r->mutex);
+    return r->records.size();
+}
+
+/*!
+ * \brief returns the records in the ring buffer, oldest first
+ */
+QStringList QuMultiReaderTrace::ringBuffer() {
+    QuMultiReaderTraceRing *r = ring();
+    QMutexLocker lock(&r->mutex);
+    QStringList l;
+    const int size = r->records.size();
+    for(int i = 0; i < r->count; i++)
+        l << r->records[(r->head - r->count + i + size) % size];
+    return l;
+}
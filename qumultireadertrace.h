@@ -0,0 +1,47 @@
+#ifndef QUMULTIREADERTRACE_H
+#define QUMULTIREADERTRACE_H
+
+#include <QStringList>
+
+/*
+ * Tracing for the multi reader.
+ *
+ * QUMULTIREADER_TRACE_LEVEL is set at compile time (see cumbia-multiread.pro):
+ * 0: tracing compiled out (release builds, the default)
+ * 1: QUMR_TRACE_INFO: source setup, timer configuration
+ * 2: QUMR_TRACE_DEBUG: read cycles
+ *
+ * When compiled out, qumr_trace arguments are not even evaluated.
+ * Records are printed on stdout unless the ring buffer sink is enabled with
+ * QuMultiReaderTrace::setRingBufferSize, in which case the last n records are kept
+ * in memory and can be retrieved with QuMultiReaderTrace::ringBuffer.
+ */
+
+#ifndef QUMULTIREADER_TRACE_LEVEL
+#define QUMULTIREADER_TRACE_LEVEL 0
+#endif
+
+#define QUMR_TRACE_INFO 1
+#define QUMR_TRACE_DEBUG 2
+
+#if QUMULTIREADER_TRACE_LEVEL > 0
+#define qumr_trace(level, ...) do { if(level <= QUMULTIREADER_TRACE_LEVEL) QuMultiReaderTrace::trace(__VA_ARGS__); } while(0)
+#else
+#define qumr_trace(level, ...) do { } while(0)
+#endif
+
+class QuMultiReaderTrace
+{
+public:
+    static void trace(const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 1, 2)))
+#endif
+    ;
+
+    static void setRingBufferSize(int n);
+    static int ringBufferSize();
+    static QStringList ringBuffer();
+};
+
+#endif // QUMULTIREADERTRACE_H